@@ -2,21 +2,65 @@
 
 #define BT_ON
 
+// read the ccd through the i2s adc dma engine instead of bit-banging it, the AO pin has to be moved
+// to an ADC1 pin (see pinouts.h) since i2s can only sample ADC1
+// #define CCD_DMA_ON
+
+// run the guided dark / flat field calibration of the ccd on boot, the tables are stored in nvs and
+// used from then on, so this only has to be enabled once per sensor / lens setup
+// #define CCD_FLAT_CALIBRATION
+
+// stream every processed ccd frame as a binary record (dep/ccdTelemetryFormat.h) over serial, or
+// over bluetooth with CCD_TELEMETRY_BT, decode it offline with host/ccdTelemetryDecode.cpp
+// #define CCD_TELEMETRY_ON
+// #define CCD_TELEMETRY_BT
+
+// record the sensor log (dep/sensorLogFormat.h) over serial: ccd frames, encoder ticks, colour
+// reads and actuator commands, to be replayed with host/sensorReplay.cpp. a frame logs 148 bytes
+// and the control steps up to 7 kB / s, at serial_btr = 115200 that leaves room for about 30
+// frames / s
+// #define SENSOR_LOG_ON
+
 // paraments change frequently
 
 const int serial_btr = 115200;
 
-const float aim_speed = 0.5;
+const float aim_speed = 0.5; // ticks / ms, the car leaves a platform at a third of it
+
+// speed planner (dep/speedPlanner.h): plan_top_speed is the speed on straights, in a bend it is cut
+// so the lateral acceleration stays under plan_lateral_accel
+const float plan_top_speed     = 0.8; // ticks / ms
+const float plan_lateral_accel = 1.0; // m / s^2
+const float plan_accel         = 1.0; // m / s^2, the aim speed comes back up after a bend
+const float plan_min_speed     = 0.3; // ticks / ms
+
+// the car as the speed planner (dep/speedPlanner.h) and the host simulator see it. NOT MEASURED:
+// these are the guesses the simulator was built with, measure them on the car before relying on
+// the planner's bend speeds
+const float car_wheelbase       = 0.16;   // m, rear to front axle
+const float car_sensor_ahead    = 0.25;   // m, from the rear axle to the line the ccd looks at
+const float car_sensor_pitch    = 0.0016; // m on the ground per ccd pixel
+const float encoder_ticks_per_m = 1000;   // of travel, the speeds are in ticks / ms
+
+// the ccd frame period on the car, fixed by a hardware timer (dep/ccdPipeline.h). the explosure
+// time is set apart from it by an electronic shutter, and cut to fit into the period
+const int ccd_frame_period_ms = 100;
+
+// steering and speed run at this rate, driven by a hardware timer (dep/controlScheduler.h)
+const int control_rate_hz = 200;
+
+// the pids run on the measured control period (dep/pid.h), ki is per s and kd in s, so the gains
+// hold at any control rate
 
-// angle pid
+// angle pid, from the track centre in pixels to the steering in pixels
 const float angle_kp = 1;
 const float angle_ki = 0;
-// const float angle_ki = 0.01;
-const float angle_kd = 0.1;
+const float angle_kd = 0.005;
 
-// speed pid
-const float speed_kp = 8e4;
-const float speed_ki = 1e4;
-const float speed_kd = 1e4;
+// speed pid, from the speed in encoder ticks / ms to the motor power as a fraction of full power
+// (dep/motor.h), the units keep the gains in the range of q16.16 (dep/pid.h)
+const float speed_kp = 1.22;
+const float speed_ki = 3.05;
+const float speed_kd = 0.0076;
 
 const int platform_num = 4;
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "dep/bluetooth.h"
 #include "dep/boardLed.h"
 #include "dep/ccd.h"
+#include "dep/ccdFlatField.h"
+#include "dep/ccdStorage.h"
 #include "dep/color.h"
 #include "dep/commandParser.h"
 #include "dep/data.h"
@@ -15,6 +17,8 @@
 TaskHandle_t Task1Handle;
 TaskHandle_t Task2Handle;
 
+const UBaseType_t cTaskStackMinMargin = 1024; // bytes left unused on a task stack, at least
+
 int command = -1;
 
 // overall setup
@@ -30,18 +34,34 @@ void setup() {
   initCCD();
   initServo();
   initMotor();
+  initTracking();
   initBluetooth();
 
+#ifdef SENSOR_LOG_ON
+  sensorLogStart(Serial);
+#endif
+
+#ifdef CCD_TELEMETRY_ON
+#if defined(CCD_TELEMETRY_BT) && defined(BT_ON)
+  ccdTelemetryStart(serialBT);
+#else
+  ccdTelemetryStart(Serial);
+#endif
+#endif
+
   pinMode(PINOUT_MOTOR_ON, INPUT_PULLDOWN); // debug pin, detatch this pin will disable the motor
   oledCountdown("Booting", 200, 1);         // oled testing function
   assignTasks();                            // assign tasks for two cores
 }
 
-// assign tasks for two cores
+// assign tasks for two cores. Task1 reaches 3.3 kB deep and Task2 3.9 kB in the host simulator,
+// which measures the stacks of its tasks (dep/halLinux.h): their stacks are about twice that, for
+// what the host does not run the esp-idf code of (nvs, uart, printf). the margins are printed at
+// the first track
 void assignTasks() {
   xTaskCreatePinnedToCore(Task1,        // Task function
                           "Task1",      // Task name
-                          2000,         // Stack size
+                          6144,         // Stack size: draws the tracking screen, reports
                           NULL,         // Parameter
                           1,            // Priority
                           &Task1Handle, // Task handle to keep track of created task
@@ -50,7 +70,7 @@ void assignTasks() {
 
   xTaskCreatePinnedToCore(Task2,        // Task function
                           "Task2",      // Task name
-                          2000,         // Stack size
+                          8192,         // Stack size: tracking, explosure search, nvs, reports
                           NULL,         // Parameter
                           1,            // Priority
                           &Task2Handle, // Task handle to keep track of created task
@@ -61,16 +81,23 @@ void assignTasks() {
 // this loop is intentionally left blank
 void loop() { delay(1000); }
 
-void Task1(void* pvParameters) {
+// the task assigned to core0: draws the tracking screen while the car is tracking
+void Task1(void* /*pvParameters*/) {
   for (;;) {
     //   command = btRecieve();
     //   delay(20);
-    delay(1000);
+    trackUiUpdate();
+    delay(cTrackUiPeriodMs);
   }
 }
 
+unsigned long ccdPrepareStartMs = 0;
+bool ccdWarmBoot                = false;
+bool firstTrackReported         = false;
+
 /// @brief function to initialize ccd, the main funtion is to find the best explosure time for
-/// future use
+/// future use. the calibration stored in nvs is tried first (warm boot), the full calibration is
+/// only done when it is missing or the lighting has changed too much (cold boot)
 /// @param cameraIsBlocked whether the camera is blocked
 /// @param recordAvailable whether the record is available
 /// @param bestRecord the best record returned when the record is available, we can retrieve
@@ -79,12 +106,28 @@ void prepareCCD(bool& cameraIsBlocked, bool& recordAvailable, explosureRecord& b
   display.clearDisplay();
   cameraIsBlocked = false;
 
+  // per-pixel correction first, the explosure calibration is done on corrected frames
+#ifdef CCD_FLAT_CALIBRATION
+  if (calibrateFlatField())
+    saveCCDCorrection(ccdCorrection);
+  display.clearDisplay();
+#endif
+  ccdCorrectionEnabled = loadCCDCorrection(ccdCorrection);
+
+  ccdPrepareStartMs = millis();
+
   // the main function of preparing ccd
-  getBestExplosureTime(bestRecord, cameraIsBlocked, true);
+  ccdWarmBoot = warmStartCCD(bestRecord, true);
+  if (!ccdWarmBoot) {
+    calibrateExplosure(bestRecord, cameraIsBlocked, true);
+    if (bestRecord.isValid && !cameraIsBlocked)
+      saveCCDCalibration(bestRecord);
+  }
   recordAvailable = bestRecord.isValid;
 
   // the switch condition to tell whether the camera is been blocked
   Serial.println("----------------------------------------");
+  Serial.println(ccdWarmBoot ? "warm boot: stored calibration reused" : "cold boot: calibrated");
   if (cameraIsBlocked) {
     Serial.println("bluetooth mode activated");
   } else {
@@ -103,14 +146,42 @@ void prepareCCD(bool& cameraIsBlocked, bool& recordAvailable, explosureRecord& b
 
   Serial.println("----------------------------------------");
 
-  // print some important values to oled
+  // print some important values to oled, there is nothing new to read on a warm boot
   oledPrint(bestRecord.explosureTime, "expl", 0);
   oledPrint(bestRecord.avgVal, "parting avg", 1);
   oledFlush();
-  delay(2000);
+  if (!ccdWarmBoot)
+    delay(2000);
   display.clearDisplay();
 }
 
+// print the least free stack of both tasks so far, by the time of the first track Task2 has been
+// through the calibration, the nvs and the first frames
+void reportStackMargins() {
+  UBaseType_t margins[2] = {uxTaskGetStackHighWaterMark(Task1Handle),
+                            uxTaskGetStackHighWaterMark(Task2Handle)};
+  for (int i = 0; i < 2; i++) {
+    Serial.print("Task");
+    Serial.print(i + 1);
+    Serial.print(" stack margin: ");
+    Serial.print(margins[i]);
+    Serial.println(margins[i] < cTaskStackMinMargin ? " bytes, too low" : " bytes");
+  }
+}
+
+// print the time from the start of the ccd preparation to the first tracked frame, once
+void reportFirstTrack() {
+  if (firstTrackReported || lastTrackEstimate.centreQ8 == -1)
+    return;
+  firstTrackReported = true;
+
+  Serial.print(ccdWarmBoot ? "warm" : "cold");
+  Serial.print(" boot, time to first track: ");
+  Serial.print(millis() - ccdPrepareStartMs);
+  Serial.println(" ms");
+  reportStackMargins();
+}
+
 int loopTime = 0;
 int prevTime = 0;
 
@@ -128,7 +199,7 @@ bool connected = false;
 
 /// @brief the task assigned to core1
 /// @param pvParameters
-void Task2(void* pvParameters) {
+void Task2(void* /*pvParameters*/) {
   // turn the color sensor on and setup the blank color, since the initial lighting status may vary,
   // we need to calculate it every time we start
   colorSensorOn();
@@ -165,30 +236,26 @@ void Task2(void* pvParameters) {
     oledFlush();
     delay(1000);
 
+    // from now on the ccd is read out by a background task on core 0, the next frame is integrated
+    // while the current one is being processed here
+    ccdPipelineStart(bestRecord.explosureTime);
+    trackPeriods.setNominal(ccdPipelineFramePeriodUs());
+
+    // steering and speed run in a task of their own at control_rate_hz, the loop below only tracks
+    // the line and runs the platform stops, and the screen is drawn by Task1
+    controlSchedulerStart(control_rate_hz, controlTrackStep);
+    trackUiResume();
+
     // a closed loop for tracking purpose
     for (;;) {
-      display.clearDisplay();
-
-      // the ccd's explosuring time will be a major drawback of excecution time, therefore we use
-      // the excecution time of other functions to compensate the ccd explosure time
-      int prevTimeMs               = getTime();
-      bool noTimeRecord            = (prevTimeMs == -1);
-      int substractedExplosureTime = 0;
-      if (!noTimeRecord) {
-        substractedExplosureTime -= prevTimeMs;
-        if (substractedExplosureTime < 0)
-          substractedExplosureTime = 0;
-
-        // Frame length, proper explosure time
-        oledPrint("std", bestRecord.explosureTime, "frm", prevTimeMs, 0);
-      }
+      bool noTimeRecord = (getTime() == -1);
 
       // if there's no time record (prev time is not setuped), or the car is just returning to
       // tracking state from the platform detection state, we will tell the ccd sensor to clear all
       // the explosuring values and start as new
-      returnFromPlatform = autoTrack(bestRecord, bestRecord.explosureTime, substractedExplosureTime,
-                                     noTimeRecord || returnFromPlatform);
-      oledFlush();
+      returnFromPlatform =
+          autoTrack(bestRecord, bestRecord.explosureTime, noTimeRecord || returnFromPlatform);
+      reportFirstTrack();
     }
   }
 }
\ No newline at end of file
@@ -1,77 +1,291 @@
 #pragma once
 
+#include <atomic>
+
 #include "../args.h"
 #include "bluetooth.h"
 #include "boardLed.h"
 #include "ccd.h"
 #include "color.h"
 #include "commandParser.h"
+#include "controlScheduler.h"
 #include "data.h"
+#include "mailbox.h"
 #include "motor.h"
 #include "oled.h"
 #include "pid.h"
 #include "pinouts.h"
 #include "servo.h"
+#include "speedPlanner.h"
+#include "trackFilter.h"
+
+// Track filter
+const float cTrackProcessNoise     = 2e5f; // (pixel / s^2)^2, how hard the line can swing
+const float cTrackMeasurementNoise = 1.0f; // pixel^2, for a perfectly sharp line
+const int cTrackMaxCoastFrames     = 8;
+const float cTrackLeadTime         = 0.005f; // s, capture latency made up by the prediction
+
+// Platform approach
+const float cPlatformApproachSpeed = 0.25f; // ticks / ms at most, while a platform is ahead
+
+// Speed planner
+const float cPlanPreviewTime = 0.1f; // s the track centre is moved on with its rate
+
+// Control loop
+const int cSpeedControlHz    = 20;    // the speed pid runs on every n-th control step, at this rate
+const float cSteeringFilterS = 0.02f; // s, derivative filter of the steering pid
+const float cSteeringCentre  = 64;    // pixel the wheels point straight at
+
+static_assert(control_rate_hz >= cSpeedControlHz && control_rate_hz % cSpeedControlHz == 0,
+              "control_rate_hz is a multiple of the speed loop rate");
+
+// Tracking screen
+const int cTrackUiPeriodMs          = 100;
+const unsigned long cTimingReportMs = 5000; // control timing to serial, unless a log streams there
+
+// what the control step does, set by the tracking loop
+const int CONTROL_TRACKING = 0; // steer along the track at the aim speed
+const int CONTROL_STOPPED  = 1; // wheels straight and braking: at a platform, or the track is lost
+const int CONTROL_LEAVING  = 2; // wheels straight at a third of the aim speed, off a platform
+
+// the track estimate the tracking loop hands to the control step after every frame
+struct trackMail {
+  float midPixel;   // filtered track centre, led by the capture latency
+  float midRate;    // pixel / s
+  bool approaching; // a platform is ahead
+};
 
 int location = 0;
-pid angelPID(angle_kp, angle_ki, angle_kd);
+pid<float> angelPID(angle_kp, angle_ki, angle_kd);
+speedPlanner trackPlanner(plan_lateral_accel, plan_accel, plan_min_speed, cPlanPreviewTime);
+trackFilter trackKalman(cTrackProcessNoise, cTrackMeasurementNoise, cTrackMaxCoastFrames);
 bt_data data;
 
-bool autoTrack(explosureRecord& bestRecord, int bestExplosureTime, int substractedExplosureTime,
-               bool initStarting) {
-  // motor_on pin is a debug pin, as mentioned in the main loop
-  bool motorEnable = digitalRead(PINOUT_MOTOR_ON) ? true : false;
-  // motorAimSpeed is read from the car configuration file, thus we can change its value freely
-  // later this function
-  float motorAimSpeed = motorEnable ? aim_speed : 0;
+unsigned long lastTrackFilterUs = 0;
 
-  int trackMidPixel = 0;
-  int trackStatus   = 0;
+// the speed autoTrack aims for on straights and the one it leaves a platform with, plan_top_speed
+// and aim_speed unless they are changed at run time (host simulator). the speed planner cuts the
+// top speed in bends
+float trackTopSpeed = plan_top_speed;
+float trackAimSpeed = aim_speed;
 
-  // read the raw values from ccd
-  if (initStarting) {
-    // we will clear all the previous explosure values and do explosuring another time, this is time
-    // consuming but accurate in vaule readings, for we can fine tune the exactly explosuring time
-    processCCD(trackMidPixel, trackStatus, bestExplosureTime, true, false);
+// the outcome of the last autoTrack call, read by the sensor log replay and the tracking screen
+int lastTrackStatus       = STATUS_NORMAL;
+float lastTrackMidPixel   = 0;
+bool lastTrackApproaching = false;
+
+mailbox<trackMail> trackMailbox;
+std::atomic<int> controlMode{CONTROL_TRACKING};
+trackMail controlTrack{}; // the estimate the control step works with, owned by the control task
+unsigned long controlStepCount = 0;
+float speedStepDt              = 0; // s since the previous speed step
+
+// periods of the tracking loop, i.e. of the processed frames, owned by the tracking task
+periodHistogram trackPeriods;
+seqlockCell<periodHistogram> trackPeriodsSnapshot; // trackPeriods, for the ui task
+
+std::atomic<bool> trackUiActive{false};
+std::atomic<bool> trackUiDrawing{false};
+unsigned long lastTimingReportMs = 0;
+
+// set the steering pid up, its output is the offset of the wheels from straight in pixels, limited
+// to full lock either way
+void initTracking() {
+  angelPID.setOutputLimits(-cSteeringCentre, cSteeringCentre);
+  angelPID.setBackCalculation((angle_kp > 0) ? angle_ki / angle_kp : 0);
+  angelPID.setDerivativeFilter(cSteeringFilterS);
+}
+
+// run the track filter on the result of processCCD: measurements are smoothed by it, and a frame
+// without track is bridged with the prediction for a few frames before NO_TRACK gets through
+void filterTrack(float& trackMidPixel, int& trackStatus, bool initStarting) {
+  unsigned long nowUs = micros();
+  float dt            = (lastTrackFilterUs == 0) ? 0 : (nowUs - lastTrackFilterUs) * 1e-6f;
+  lastTrackFilterUs   = nowUs;
+
+  if (initStarting || trackStatus == STATUS_PLATFORM) {
+    trackKalman.reset();
+    if (trackStatus == STATUS_PLATFORM)
+      return;
+  }
+
+  trackKalman.predict(dt);
+
+  if (trackStatus == STATUS_NORMAL) {
+    float confidence = float(lastTrackEstimate.sharpness) / float(cSharpnessMax);
+    trackKalman.update(trackMidPixel, confidence);
+  } else if (trackStatus == STATUS_NO_TRACK && trackKalman.coast()) {
+    trackStatus = STATUS_COASTING;
   } else {
-    // the ccd explosuring value is not cleared, and will be reused. if we want to use this value,
-    // we have to adjust the explosuring time due to the excecution time in the last loop
-    processCCD(trackMidPixel, trackStatus, substractedExplosureTime, false, false);
+    return;
   }
 
-  // switch for all the status to print onto the oled screen
-  switch (trackStatus) {
-    // if the car is in normal tracking state
+  trackMidPixel = trackKalman.position(cTrackLeadTime);
+}
+
+// hand the state of the track filter over to the control step
+void publishTrack(bool approaching) {
+  trackMail mail;
+  mail.midPixel    = trackKalman.position(cTrackLeadTime);
+  mail.midRate     = trackKalman.rate();
+  mail.approaching = approaching;
+  trackMailbox.publish(mail);
+}
+
+// one step of the control loop, run by the control scheduler at control_rate_hz: the wheels are
+// steered towards the latest track estimate, the speed planner sets the aim speed from the track
+// and the steering, and the speed loop runs on every n-th step. the estimate is held between
+// frames, moving it on with the filter's rate overshoots: the rate still carries the steering error
+// the car has corrected since the frame
+void controlTrackStep(float dt) {
+  trackMailbox.read(controlTrack);
+  bool speedStep = controlStepCount++ % (control_rate_hz / cSpeedControlHz) == 0;
+  speedStepDt += dt;
+
+  // motor_on pin is a debug pin, as mentioned in the main loop
+  bool motorEnable    = digitalRead(PINOUT_MOTOR_ON) ? true : false;
+  float motorTopSpeed = motorEnable ? trackTopSpeed : 0;
+  float motorAimSpeed = motorEnable ? trackAimSpeed : 0;
+
+  switch (controlMode.load()) {
+    // the car will steer its wheel according to the mid pixel of the ccd sensor, with the help of a
+    // fine-tuned pid controller. the car will move forward
+  case CONTROL_TRACKING: {
+    // the track centre is where the wheels should point
+    float steer = angelPID.update(controlTrack.midPixel, cSteeringCentre, dt);
+    servoWritePixel(steer + cSteeringCentre);
+
+    // slower into and through bends
+    float wheelDeg = steer / cSteeringCentre * cAngleLimit;
+    motorAimSpeed  = trackPlanner.update(controlTrack.midPixel - cSteeringCentre,
+                                         controlTrack.midRate, wheelDeg, motorTopSpeed, dt);
+    // the black ratio is rising towards a platform, slow down so the stop is short and straight
+    if (controlTrack.approaching)
+      motorAimSpeed = min(motorAimSpeed, cPlatformApproachSpeed);
+    if (speedStep)
+      motorForward(motorAimSpeed, speedStepDt);
+    break;
+  }
+  case CONTROL_LEAVING:
+    servoWritePixel(cSteeringCentre);
+    angelPID.reset();
+    trackPlanner.reset();
+    if (speedStep)
+      motorForward(motorAimSpeed / 3, speedStepDt);
+    break;
+  default:
+    // both loops start over once the car moves again
+    servoWritePixel(cSteeringCentre);
+    angelPID.reset();
+    trackPlanner.reset();
+    motorBrake();
+    speedStepDt = 0;
+    break;
+  }
+  if (speedStep)
+    speedStepDt = 0;
+
+  sensorLogActuators();
+}
+
+// the tracking screen is drawn by Task1, out of the way of the tracking loop. the tracking loop
+// takes the screen back for the platform stops, and waits for a frame being drawn to be finished
+void trackUiPause() {
+  trackUiActive = false;
+  while (trackUiDrawing)
+    delay(1);
+}
+
+void trackUiResume() { trackUiActive = true; }
+
+// draw the tracking screen, and report the control timing over serial every cTimingReportMs
+void trackUiUpdate() {
+  trackUiDrawing = true;
+  if (!trackUiActive) {
+    trackUiDrawing = false;
+    return;
+  }
+
+  display.clearDisplay();
+  periodHistogram periods = trackPeriodsSnapshot.read();
+  // explosure time, frame length
+  int frameMs = int(periods.lastPeriodUs / 1000);
+  oledPrint("exp", ccdPipelineExplosureTime.load(), "frm", frameMs, 0);
+  switch (lastTrackStatus) {
   case STATUS_NORMAL:
-    boardLedOff();
-    oledPrint("TRACKING", 1);
+    oledPrint(lastTrackApproaching ? "APPROACH" : "TRACKING", 1);
     break;
-    // if the car cannot see the track...
   case STATUS_NO_TRACK:
-    boardLedOff();
     oledPrint("!!!NOTRACK", 1);
     break;
-    // if a platform is detected
+  case STATUS_COASTING:
+    oledPrint("COASTING", 1);
+    break;
   case STATUS_PLATFORM:
-    boardLedOn();
     oledPrint("!!!PLATFORM", 1);
     break;
   }
+  oledPrint("bl", lastBlackNum, "wh", lastWhiteNum, 2);
+  // ccd frame timer: mean period jitter (us), skipped frames
+  oledPrint("jit", int(ccdFrameJitterAvgUs()), "ovr", int(ccdTiming.overruns), 3);
+  // control loop: longest step (us), deadline misses
+  controlStepTiming timing = controlTimingSnapshot.read();
+  oledPrint("ctl", int(timing.maxExecUs), "miss", int(timing.deadlineMisses), 4);
+  oledFlush();
+
+  bool serialFree = !sensorLogRunning && !ccdTelemetryRunning;
+  if (serialFree && millis() - lastTimingReportMs > cTimingReportMs) {
+    lastTimingReportMs = millis();
+    controlSchedulerPrint(Serial);
+    periods.print(Serial, "tracking loop period");
+  }
+  trackUiDrawing = false;
+}
+
+// the tracking loop: process a frame, hand the track estimate over to the control step and tell it
+// what to do. the platform stops are run from here, the control step only keeps the car braking
+// and the wheels straight meanwhile
+bool autoTrack(explosureRecord& /*bestRecord*/, int bestExplosureTime, bool initStarting) {
+  trackPeriods.mark(micros());
+  trackPeriodsSnapshot.write(trackPeriods);
+
+  float trackMidPixel = 0;
+  int trackStatus     = 0;
+
+  // read the raw values from ccd, the platform detector measures the bar by the speed the control
+  // step last read
+  platformGroundSpeed = encoderSpeed;
+  if (initStarting) {
+    // we will clear all the previous explosure values and do explosuring another time, this is time
+    // consuming but accurate in vaule readings, for we can fine tune the exactly explosuring time
+    processCCD(trackMidPixel, trackStatus, bestExplosureTime, true, false);
+  } else {
+    // the ccd explosuring value is not cleared, the frame integrated during the last loop is used
+    processCCD(trackMidPixel, trackStatus, bestExplosureTime, false, false);
+  }
+  filterTrack(trackMidPixel, trackStatus, initStarting);
+  lastTrackStatus      = trackStatus;
+  lastTrackMidPixel    = trackMidPixel;
+  lastTrackApproaching = platformWatch.isApproaching();
+
+  if (trackStatus == STATUS_PLATFORM)
+    boardLedOn();
+  else
+    boardLedOff();
 
-  // this time we will actually control how the car moves
   switch (trackStatus) {
-    // during the normal tracking status, the car will steer its wheel according to the mid pixel of
-    // the ccd sensor, with the help of a fine-tuned pid controller. the car will move forward
+    // the estimate is handed over before the mode, the control step never steers by a stale one
   case STATUS_NORMAL:
-    servoWritePixel(angelPID.update(trackMidPixel - 64) + 64);
-    motorForward(motorAimSpeed);
+  case STATUS_COASTING:
+    publishTrack(lastTrackApproaching);
+    controlMode = CONTROL_TRACKING;
     break;
     // when the platform is first detected:
   case STATUS_PLATFORM:
     // the car will steer its wheel back to the center, since the prev mid pixel data is not always
     // a good value to go. the car will stop
-    servoWritePixel(64);
-    motorBrake();
+    controlMode = CONTROL_STOPPED;
+    trackUiPause();
 
     // print the location out to oled screen
     display.clearDisplay();
@@ -104,20 +318,19 @@ bool autoTrack(explosureRecord& bestRecord, int bestExplosureTime, int substract
 
     // detection ended, move forward, and return to normal tracking mode after a valid track has
     // been appeared
-    motorForward(motorAimSpeed / 3);
+    controlMode = CONTROL_LEAVING;
     processCCD(trackMidPixel, trackStatus, bestExplosureTime, true, false);
     for (;;) {
       processCCD(trackMidPixel, trackStatus, bestExplosureTime, true, false);
-      oledFlush();
-      if (trackStatus == STATUS_NORMAL)
+      if (trackStatus == STATUS_NORMAL) {
+        trackUiResume();
         return true;
+      }
     }
 
     // this special case is designed for error handling, but it is mostly useless in practice
   default:
-    angelPID.reset();
-    servoWritePixel(64);
-    motorBrake();
+    controlMode = CONTROL_STOPPED;
     // the car will eventually enter this endless blinking loop and refuse to move any how, so we
     // can know there is something wrong
     for (;;) {
@@ -128,4 +341,4 @@ bool autoTrack(explosureRecord& bestRecord, int bestExplosureTime, int substract
   }
 
   return false;
-}
\ No newline at end of file
+}
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "boardLed.h"
+#include "hal.h"
 #include "pinouts.h"
 
 // the BT_ON define is in args.h, we can manually disable bluetooth functionality to greatly
 // increase uploading speed (debug function)
 #ifdef BT_ON
+#ifdef ARDUINO
 #include "../lib/arduino-esp32/libraries/BluetoothSerial/src/BluetoothSerial.h"
+#endif
 BluetoothSerial serialBT;
 #endif
 
@@ -26,7 +29,7 @@ void btSend(int message) {
 }
 
 // send information to other devices
-void btSend(char* message) {
+void btSend(const char* message) {
 #ifdef BT_ON
   serialBT.println(message);
 #endif
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "hal.h"
 #include "pinouts.h"
 
 // setup a default board led for debug use
@@ -1,9 +1,15 @@
 #pragma once
 
 #include "boardLed.h"
+#include "ccdBinary.h"
+#include "ccdCapture.h"
+#include "ccdPipeline.h"
+#include "ccdTelemetry.h"
 #include "math.h"
 #include "oled.h"
 #include "pinouts.h"
+#include "platformDetector.h"
+#include "sensorLog.h"
 
 #define DEFAULT 0
 
@@ -11,14 +17,27 @@
 const int STATUS_NORMAL   = 0;
 const int STATUS_NO_TRACK = 1;
 const int STATUS_PLATFORM = 2;
+const int STATUS_COASTING = 3; // no track in this frame, the track filter predicts it instead
 
 // Hardware related
-const int cNumPixels  = 128;
+const int cNumPixels  = cCCDFramePixels;
 const int cCountStart = 15;
 const int cCountEnd   = 126;
 
 // Line detection
 const int cEffectiveLineWidthMin = 10;
+const int cSubPixelShift         = 8; // track centre is estimated in Q8 (1/256 pixel)
+const int cSharpnessMax          = 255;
+const int cTrackFloorPixels      = 2; // either side of the track run, the floor of the centre
+
+// Segment extraction
+const int cMaxSegments = 32;
+
+// Region of interest tracking: the track is searched near the last accepted centre first, the
+// window is doubled on every miss until it covers the whole counting window
+const bool cTrackRoiEnabled  = true;
+const int cTrackRoiHalfWidth = 12;
+const int cTrackRoiMaxMisses = 5; // consecutive misses before the seed is dropped
 
 // Explosure time
 const int cDefaultExplosureTime = 10;
@@ -28,6 +47,51 @@ const int cExplosureTimeStart       = 60;
 const int cExplosureTimeEnd         = 140;
 const int cExplosureTimePropagation = 10;
 
+// Explosure search: golden-section search over the times of the full sweep instead of all of them
+const bool cExplosureFastSearch     = true;
+const int cExplosureSearchTolerance = cExplosureTimePropagation; // ms, no finer than the sweep
+const int cExplosureSearchMaxProbes = 16;
+
+// Auto explosure during tracking: the explosure is nudged so that the brightest pixels stay inside
+// the target band, changes need a few consecutive frames out of the band (hysteresis)
+const bool cAutoExplosureEnabled     = true;
+const int cAutoExplosureMin          = 10;
+const int cAutoExplosureMax          = 200;
+const int cAutoExplosureMaxStep      = 8; // ms per adjustment
+const int cAutoExplosureSettleFrames = 3;
+const int cAutoExplosureTargetLow    = cCCDAdcMax * 55 / 100;
+const int cAutoExplosureTargetHigh   = cCCDAdcMax * 85 / 100;
+const int cAutoExplosureSaturatedMax = 6; // pixels in the top histogram bin
+
+// Histogram of the counting window, built while searching min / max
+const int cLinearHistogramBins     = 64;
+const int cLinearHistogramBinWidth = (cCCDAdcMax + 1) / cLinearHistogramBins;
+
+// Thresholding methods used during tracking
+const int THRESHOLD_MIDPOINT = 0; // (min + max) / 2, or the average of the last tracked frame
+const int THRESHOLD_OTSU     = 1; // otsu's split of the histogram, hot pixels barely move it
+const int THRESHOLD_ADAPTIVE = 2; // local mean, blended with otsu, for lighting gradients
+
+const int cThresholdMode         = THRESHOLD_OTSU;
+const int cAdaptiveWindowHalf    = 20; // local mean over 41 pixels, about twice the line width
+const int cAdaptiveOffsetPercent = 10; // of the contrast, below the local mean to be dark
+const int cFlatFrameContrastPercent = 40; // of the last tracked frame's contrast, below is flat
+
+// Platform detection: a frame is a platform candidate above the enter ratio of black pixels, the
+// platform is confirmed by N of the last M candidates and released after M frames below the exit
+// ratio. a smoothed black ratio that keeps rising flags the platform as approaching. the 0.15 m bar
+// is under the sensor for fewer than N frames above about 0.6 m/s at a 77 ms frame period, so the
+// candidates also confirm it once they cover a third of it: each stands for the ground travelled
+// since the frame before (the speed times the time between the frames). down to two of them from
+// 0.33 m/s and to one from 0.65 m/s, at that period, and the bar is still seen up to 1.3 m/s
+const float cPlatformEnterRatio    = 0.7f;
+const float cPlatformExitRatio     = 0.5f;
+const int cPlatformConfirmHits     = 3;
+const int cPlatformConfirmWindow   = 5;
+const float cPlatformConfirmTravel = 0.05f; // m
+const float cPlatformApproachRatio = 0.3f;
+const float cPlatformApproachSlope = 0.01f; // smoothed black ratio per frame
+
 // Dark / light dynamic propagation
 const float cThreholdSearchingPropagationInit = 0.01f;
 const float cThreholdSearchingPropagation     = 0.1f;
@@ -40,13 +104,69 @@ const float cMinMaxRatioDeltaBlocked = 0.6f;
 // Solid Black Line Detection
 const float cBlockingConditionRatio = 0.5f;
 
-// buffers allocated statically
-int linearData[cNumPixels]{};
-bool binaryData[cNumPixels]{};
+// buffers allocated statically, linearData points to the frame currently being processed, which is
+// the front frame of the pipeline (ccdPipeline.h)
+uint8_t* linearData = ccdFrames[ccdFrontFrame].linear;
+binaryLine binaryData{};
+platformDetector platformWatch(cPlatformEnterRatio, cPlatformExitRatio, cPlatformConfirmHits,
+                               cPlatformConfirmWindow, cPlatformConfirmTravel,
+                               cPlatformApproachRatio, cPlatformApproachSlope);
+
+// the speed of the car the platform detector measures the travel between frames with, ticks / ms.
+// kept up to date by the tracking loop, at 0 the detector only counts frames
+float platformGroundSpeed         = 0;
+unsigned long platformLastFrameMs = 0;
 bool binaryOnehotData[cNumPixels]{};
 
 int avgMarkingVal = 0;
 
+int linearHistogram[cLinearHistogramBins]{};
+
+// the sub-pixel estimation of the track centre, made from the dark run found in the binary line
+struct trackEstimate {
+  int centreQ8;  // raw pixel position of the centre in Q8, -1 if invalid
+  int sharpness; // how steep the run's edges are relative to the frame contrast, 0 -> 255
+};
+
+trackEstimate lastTrackEstimate{-1, 0};
+
+// per-frame statistics of the roi search, a frame counts once in exactly one of the outcomes
+struct trackRoiStats {
+  unsigned long frames;
+  unsigned long roiHits;     // found inside the initial window around the seed
+  unsigned long widenedHits; // found after widening the window
+  unsigned long fullScans;   // no seed available, classic left to right scan
+  unsigned long misses;      // nothing wide enough anywhere
+  unsigned long pixelsSearched;
+};
+
+trackRoiStats roiStats{};
+
+// the cost of the last explosure calibration
+struct explosureCalibration {
+  unsigned long captures;
+  unsigned long durationMs;
+};
+
+explosureCalibration explosureCalibrationStats{};
+
+// one dark or light run of the binarized frame
+struct ccdSegment {
+  uint8_t start;    // first pixel
+  uint8_t end;      // last pixel
+  bool dark;        // run of dark pixels
+  uint8_t meanVal;  // mean raw value over the run
+  int16_t contrast; // mean of the neighbouring runs - meanVal
+};
+
+struct ccdSegmentList {
+  int count;
+  bool overflow; // the frame had more runs than cMaxSegments, the rest is missing
+  ccdSegment segments[cMaxSegments];
+};
+int roiSeedPixel = -1; // raw pixel of the last accepted centre, -1 if there is no seed
+int roiMissCount = 0;
+
 // the struct definition of the explosure record, contains is as below
 struct explosureRecord {
   int minVal;
@@ -58,78 +178,55 @@ struct explosureRecord {
 };
 
 // initialization function
-void initCCD() {
-  pinMode(PINOUT_CCD_SI, OUTPUT);
-  pinMode(PINOUT_CCD_CLK, OUTPUT);
-  pinMode(PINOUT_CCD_AO, INPUT);
+void initCCD() { initCCDCapture(); }
 
-  digitalWrite(PINOUT_CCD_SI, LOW);  // IDLE state
-  digitalWrite(PINOUT_CCD_CLK, LOW); // IDLE state
-}
+// capture one frame into linearData, the readout itself is done by the capture engine
+// (ccdCapture.h), then wait for the next explosure to integrate
+unsigned long ccdCaptureCount = 0;
 
-// the real function to capture the pixel values from the ccd hardware device
 void captrueCCD(int explosureTimeMs) {
-  digitalWrite(PINOUT_CCD_CLK, LOW);
-  delayMicroseconds(1);
-  digitalWrite(PINOUT_CCD_SI, HIGH);
-  delayMicroseconds(1);
-
-  digitalWrite(PINOUT_CCD_CLK, HIGH);
-  delayMicroseconds(1);
-  digitalWrite(PINOUT_CCD_SI, LOW);
-  delayMicroseconds(1);
-
-  digitalWrite(PINOUT_CCD_CLK, LOW);
-  delayMicroseconds(2);
-
-  /* and now read the real image */
-
-  for (int i = 0; i < cNumPixels; i++) {
-    digitalWrite(PINOUT_CCD_CLK, HIGH);
-
-    delayMicroseconds(2);
-    linearData[i] = analogRead(PINOUT_CCD_AO); // 8-bit is enough
-    digitalWrite(PINOUT_CCD_CLK, LOW);
-    delayMicroseconds(2);
-  }
-
-  digitalWrite(PINOUT_CCD_CLK, HIGH);
-  delayMicroseconds(2);
+  ccdCaptureFrame(linearData);
+  ccdCaptureCount++;
 
   delay(explosureTimeMs);
 }
 
+// debug functions below build the whole line first and print it with one call, for the per frame
+// stream use the binary telemetry (ccdTelemetry.h) instead
+char ccdDebugLine[cNumPixels + 1];
+
 // debug function: print the linear data to serial
 void printCCDLinearData(int maxVal) {
   for (int i = 0; i < cNumPixels; i++) {
-    int t = floor(float(linearData[i]) / float(maxVal) * 10.0f - 0.1f);
-    Serial.print(char(48 + t));
+    int t           = floor(float(linearData[i]) / float(maxVal) * 10.0f - 0.1f);
+    ccdDebugLine[i] = char(48 + t);
   }
-  Serial.println();
+  ccdDebugLine[cNumPixels] = '\0';
+  Serial.println(ccdDebugLine);
 }
 
 // debug function: print the binary data to serial
 void printCCDBinaryRawData() {
-  for (int i = 0; i < cNumPixels; i++) {
-    char c = binaryData[i] ? 'x' : '-';
-    Serial.print(c);
-  }
-  Serial.println();
+  for (int i = 0; i < cNumPixels; i++)
+    ccdDebugLine[i] = binaryLineGet(binaryData, i) ? 'x' : '-';
+  ccdDebugLine[cNumPixels] = '\0';
+  Serial.println(ccdDebugLine);
 }
 
 // debug function: print the one ot data, indicating the center of the track, to serial
 void printCCDOneHotData() {
-  for (int i = 0; i < cNumPixels; i++) {
-    char c = binaryOnehotData[i] ? '^' : ' ';
-    Serial.print(c);
-  }
-  Serial.println();
+  for (int i = 0; i < cNumPixels; i++)
+    ccdDebugLine[i] = binaryOnehotData[i] ? '^' : ' ';
+  ccdDebugLine[cNumPixels] = '\0';
+  Serial.println(ccdDebugLine);
 }
 
-// loop through all linear values, and get the maximum & minimum value from it
+// loop through all linear values, and get the maximum & minimum value from it, the histogram of
+// the counting window is filled on the way
 void parseLinearVals(int& minVal, int& maxVal, int& avgVal, bool debug = false) {
   maxVal = 0;
   minVal = 1e6;
+  memset(linearHistogram, 0, sizeof(linearHistogram));
 
   for (int i = cCountStart; i <= cCountEnd; i++) {
     int currentVal = linearData[i];
@@ -138,6 +235,8 @@ void parseLinearVals(int& minVal, int& maxVal, int& avgVal, bool debug = false)
       maxVal = currentVal;
     if (minVal > currentVal)
       minVal = currentVal;
+
+    linearHistogram[min(currentVal, cCCDAdcMax) / cLinearHistogramBinWidth]++;
   }
   avgVal = customRound(float(minVal + maxVal) / 2.0f);
 
@@ -153,31 +252,81 @@ void parseLinearVals(int& minVal, int& maxVal, int& avgVal, bool debug = false)
   }
 }
 
-// get the black and white pixel num from the binary array
-void parseBinaryVals(int& blackNum, int& whiteNum, int& totalNum, bool debug = false) {
-  blackNum = whiteNum = 0;
+// get the black and white pixel num from the binary array, only the counting window is ever set
+void parseBinaryVals(int& blackNum, int& whiteNum, int& totalNum, bool /*debug*/ = false) {
+  totalNum = cCountEnd - cCountStart + 1;
+  blackNum = binaryLinePopcount(binaryData);
+  whiteNum = totalNum - blackNum;
+}
 
-  for (int i = cCountStart; i <= cCountEnd; i++) {
-    bool currentVal = binaryData[i];
+// the function to convert linear (raw) data to binary data, returns the threshold being used
+int linearToBinary(int minVal, int maxVal, int partingAvg = 0) {
+  partingAvg = (partingAvg == 0) ? (minVal + maxVal) / 2 : partingAvg;
 
-    if (currentVal) {
-      blackNum++;
-    } else {
-      whiteNum++;
+  binaryLinePack(linearData, partingAvg, cCountStart, cCountEnd, binaryData);
+  return partingAvg;
+}
+
+// otsu's method on the histogram of the counting window: the split maximizing the between-class
+// variance w0 * w1 * (mu0 - mu1) ^ 2, bounded cost of one pass over the bins. returns the value
+// below which a pixel is dark
+int otsuThreshold(int minVal, int maxVal) {
+  float totalNum = 0, totalSum = 0;
+  for (int b = 0; b < cLinearHistogramBins; b++) {
+    totalNum += linearHistogram[b];
+    totalSum += float(linearHistogram[b]) * b;
+  }
+
+  float darkNum = 0, darkSum = 0, bestVariance = 0;
+  int bestBin = -1;
+  for (int b = 0; b < cLinearHistogramBins - 1; b++) {
+    darkNum += linearHistogram[b];
+    darkSum += float(linearHistogram[b]) * b;
+
+    float lightNum = totalNum - darkNum;
+    if (darkNum == 0 || lightNum == 0)
+      continue;
+
+    float meanDelta = darkSum / darkNum - (totalSum - darkSum) / lightNum;
+    float variance  = darkNum * lightNum * meanDelta * meanDelta;
+    if (variance > bestVariance) {
+      bestVariance = variance;
+      bestBin      = b;
     }
   }
 
-  totalNum = blackNum + whiteNum;
+  // everything fell into one bin, nothing to split
+  if (bestBin == -1)
+    return (minVal + maxVal) / 2;
+
+  return (bestBin + 1) * cLinearHistogramBinWidth;
 }
 
-// the function to convert linear (raw) data to binary data
-void linearToBinary(int minVal, int maxVal, int partingAvg = 0) {
-  memset(binaryData, 0, sizeof(binaryData));
+// adaptive binarization: a pixel is dark when it is below both its local mean (minus a margin
+// relative to the contrast) and the global threshold plus the same margin. the local mean follows
+// lighting gradients along the line, the global bound keeps flat light areas from turning dark
+void linearToBinaryAdaptive(int minVal, int maxVal, int globalThreshold) {
+  binaryLineClear(binaryData);
 
-  partingAvg = (partingAvg == 0) ? (minVal + maxVal) / 2 : partingAvg;
+  int margin = (maxVal - minVal) * cAdaptiveOffsetPercent / 100;
+  int from   = cCountStart;
+  int to     = min(cCountStart + cAdaptiveWindowHalf, cCountEnd);
+
+  long windowSum = 0;
+  for (int i = from; i <= to; i++)
+    windowSum += linearData[i];
 
   for (int i = cCountStart; i <= cCountEnd; i++) {
-    binaryData[i] = (linearData[i] < partingAvg) ? true : false;
+    // slide the window [i - half, i + half], clipped to the counting window
+    if (i - cAdaptiveWindowHalf - 1 >= cCountStart)
+      windowSum -= linearData[from++];
+    if (i + cAdaptiveWindowHalf <= cCountEnd && i + cAdaptiveWindowHalf > to)
+      windowSum += linearData[++to];
+
+    int localThreshold = windowSum / (to - from + 1) - margin;
+    int threshold      = min(localThreshold, globalThreshold + margin);
+    uint32_t bit       = uint32_t(linearData[i] - threshold) >> 31;
+    binaryData.words[i >> 5] |= bit << (i & 31);
   }
 }
 
@@ -192,10 +341,82 @@ void drawOneHot(int point) {
   }
 }
 
+// find the nearest dark run from left which is wide enough to be the track
+bool getTrackRun(int& trackLeftPixel, int& trackRightPixel) {
+  return binaryLineFindRun(binaryData, cCountStart, cCountEnd, cEffectiveLineWidthMin,
+                           trackLeftPixel, trackRightPixel);
+}
+
+// get the wide-enough dark run, starting inside [from, to], whose middle is nearest to seedPixel
+bool getTrackRunNear(int seedPixel, int from, int to, int& trackLeftPixel, int& trackRightPixel) {
+  // a run straddling the left border of the window belongs to the window as well
+  while (from > cCountStart && binaryLineGet(binaryData, from) &&
+         binaryLineGet(binaryData, from - 1))
+    from--;
+
+  bool found   = false;
+  int bestDist = cNumPixels * 2;
+  int pos      = from;
+  int left, right;
+
+  while (pos <= to &&
+         binaryLineFindRun(binaryData, pos, cCountEnd, cEffectiveLineWidthMin, left, right)) {
+    if (left > to)
+      break;
+
+    int dist = abs(left + right - 2 * seedPixel);
+    if (dist < bestDist) {
+      bestDist        = dist;
+      trackLeftPixel  = left;
+      trackRightPixel = right;
+      found           = true;
+    }
+    pos = right + 1;
+  }
+
+  return found;
+}
+
+// roi tracking: search around the seed of the last frame first, and only widen the window when the
+// track is not in there, this rejects dark smudges far away from the real line
+bool findTrackRun(int& trackLeftPixel, int& trackRightPixel) {
+  roiStats.frames++;
+
+  if (!cTrackRoiEnabled || roiSeedPixel == -1) {
+    roiStats.fullScans++;
+    roiStats.pixelsSearched += cCountEnd - cCountStart + 1;
+    if (getTrackRun(trackLeftPixel, trackRightPixel))
+      return true;
+    roiStats.misses++;
+    return false;
+  }
+
+  for (int halfWidth = cTrackRoiHalfWidth;; halfWidth *= 2) {
+    int from = max(roiSeedPixel - halfWidth, cCountStart);
+    int to   = min(roiSeedPixel + halfWidth, cCountEnd);
+    roiStats.pixelsSearched += to - from + 1;
+
+    if (getTrackRunNear(roiSeedPixel, from, to, trackLeftPixel, trackRightPixel)) {
+      if (halfWidth == cTrackRoiHalfWidth)
+        roiStats.roiHits++;
+      else
+        roiStats.widenedHits++;
+      roiMissCount = 0;
+      return true;
+    }
+
+    if (from == cCountStart && to == cCountEnd)
+      break;
+  }
+
+  roiStats.misses++;
+  if (++roiMissCount >= cTrackRoiMaxMisses)
+    roiSeedPixel = -1;
+  return false;
+}
+
 // the core function of the ccd parsing logic:
 int getTrackMidPixel() {
-  int accumulatedDarkPixel = 0;
-
   int trackLeftPixel  = -1;
   int trackRightPixel = -1;
   int trackMidPixel   = -1;
@@ -203,36 +424,7 @@ int getTrackMidPixel() {
   // parse binary data from left to right, and get the nearset black line from left, if the line
   // width meets the requirement, then record the mid point of this black line to be the track mid
   // pixel
-  for (int i = cCountStart; i <= cCountEnd; i++) {
-    bool currentPixel = binaryData[i];
-
-    // Dark pixel
-    if (currentPixel == true) {
-      if (trackLeftPixel == -1) {
-        trackLeftPixel = i;
-      }
-      accumulatedDarkPixel++;
-    }
-
-    // White pixel
-    else {
-      if (accumulatedDarkPixel >= customRound(cEffectiveLineWidthMin)) {
-        trackRightPixel = i - 1;
-        break;
-      }
-
-      accumulatedDarkPixel = 0;
-      trackLeftPixel       = -1;
-    }
-  }
-
-  // Reaches the end
-  if (trackRightPixel == -1 && accumulatedDarkPixel >= customRound(cEffectiveLineWidthMin)) {
-    trackRightPixel = cCountEnd;
-  }
-
-  // Nothing valid
-  if (trackLeftPixel == -1 || trackRightPixel == -1)
+  if (!getTrackRun(trackLeftPixel, trackRightPixel))
     return -1;
 
   // Get mid point
@@ -250,98 +442,156 @@ int getTrackMidPixel() {
   return trackMidPixel;
 }
 
-// function excecuted once a power-on: get the best explosure time
-// we get the best explosure time by testing every possible explosure time, and find the t with
-// highest contrast (max / min)
-void getBestExplosureTime(explosureRecord& bestRecord, bool& cameraIsBlocked, bool debug = false) {
-  cameraIsBlocked    = false;
-  bestRecord.isValid = false;
+// the mean of the pixels of [from, to] inside the counting window, -1 if there are none
+int floorLevel(int from, int to) {
+  from = max(from, cCountStart);
+  to   = min(to, cCountEnd);
+  if (from > to)
+    return -1;
 
-  int recordSize = (cExplosureTimeEnd - cExplosureTimeStart) / cExplosureTimePropagation + 1;
-  float threholdsForEachExplosureTime[recordSize];
-  float minMaxRatioResults[recordSize];
-  explosureRecord records[recordSize];
+  int sum = 0;
+  for (int i = from; i <= to; i++)
+    sum += linearData[i];
+  return sum / (to - from + 1);
+}
 
-  // Test for each explosuring time
-  for (uint8_t i = 0; i < recordSize; i++) {
-    explosureRecord& thisRecord = records[i];
+// sub-pixel track centre: the pixels of the run, plus one pixel on each side to catch the partly
+// covered edge pixels, are weighted by the share of them the line covers, and the centre is their
+// centroid. the pixels inside the run are covered, the two at either end by the fraction of the
+// line's depth (floor - line level) they are darker than the floor. the floor is taken next to the
+// run on either side and interpolated in a straight line between them to follow a lighting
+// gradient, the threshold would cut the edge pixels off and is only the floor when there is no
+// floor on either side. the edge gradients tell how sharp (well focused and exposed) the line is
+void estimateTrackCentre(int trackLeftPixel, int trackRightPixel, int threshold, int contrast,
+                         trackEstimate& estimate) {
+  int from = max(trackLeftPixel - 1, cCountStart);
+  int to   = min(trackRightPixel + 1, cCountEnd);
+
+  int leftFloor  = floorLevel(trackLeftPixel - 1 - cTrackFloorPixels, trackLeftPixel - 2);
+  int rightFloor = floorLevel(trackRightPixel + 2, trackRightPixel + 1 + cTrackFloorPixels);
+  if (leftFloor < 0)
+    leftFloor = (rightFloor < 0) ? threshold : rightFloor;
+  if (rightFloor < 0)
+    rightFloor = leftFloor;
+
+  // the floor levels are the ones of the middles of their samples, the floor of pixel i is
+  // interpolated between them in Q8
+  int leftAt   = max(trackLeftPixel - 1 - cTrackFloorPixels, cCountStart);
+  int rightAt  = min(trackRightPixel + 1 + cTrackFloorPixels, cCountEnd);
+  int leftMid  = leftAt + trackLeftPixel - 2;
+  int rightMid = trackRightPixel + 2 + rightAt;
+  int span     = max(rightMid - leftMid, 1); // in half pixels
+
+  // the line's own level: the mean of the run without its end pixels, which the line may only
+  // partly cover
+  int dark = floorLevel(trackLeftPixel + 1, trackRightPixel - 1);
+  if (dark < 0)
+    dark = threshold;
+
+  int64_t weightSum    = 0;
+  int64_t weightPosSum = 0;
+  for (int i = from; i <= to; i++) {
+    int weight = 256; // inside the run, fully covered
+    if (i <= trackLeftPixel || i >= trackRightPixel) {
+      int floorQ8 = (leftFloor << 8) + (rightFloor - leftFloor) * (2 * i - leftMid) * 256 / span;
+      int depthQ8 = floorQ8 - (dark << 8);
+      if (depthQ8 <= 0)
+        continue;
+      weight = (floorQ8 - (linearData[i] << 8)) * 256 / depthQ8; // covered share in Q8
+      clamp(weight, 0, 256);
+    }
+    weightSum += weight;
+    weightPosSum += int64_t(weight) * i;
+  }
 
-    int& thisExplosureTime = thisRecord.explosureTime;
-    int& thisMinVal        = thisRecord.minVal;
-    int& thisMaxVal        = thisRecord.maxVal;
-    int& thisAvgVal        = thisRecord.avgVal;
-    bool& thisIsValid      = thisRecord.isValid;
-    float& thisContrast    = thisRecord.contrast;
+  if (weightSum == 0) {
+    estimate.centreQ8 = ((trackLeftPixel + trackRightPixel) << cSubPixelShift) / 2;
+  } else {
+    estimate.centreQ8 = int((weightPosSum << cSubPixelShift) / weightSum);
+  }
 
-    thisIsValid       = false;
-    thisExplosureTime = cExplosureTimeStart + cExplosureTimePropagation * i;
+  // a missing edge (run touching the window border) counts as the other edge
+  int leftEdge = -1, rightEdge = -1;
+  if (trackLeftPixel > cCountStart)
+    leftEdge = linearData[trackLeftPixel - 1] - linearData[trackLeftPixel];
+  if (trackRightPixel < cCountEnd)
+    rightEdge = linearData[trackRightPixel + 1] - linearData[trackRightPixel];
+  if (leftEdge < 0)
+    leftEdge = max(rightEdge, 0);
+  if (rightEdge < 0)
+    rightEdge = leftEdge;
+
+  int sharpness = (contrast <= 0) ? 0 : (leftEdge + rightEdge) * cSharpnessMax / (2 * contrast);
+  estimate.sharpness = clamp(sharpness, 0, cSharpnessMax);
+}
 
-    if (debug) {
-      Serial.print("explosure time: ");
-      Serial.println(thisExplosureTime);
-    }
+// capture one frame integrated for explosureTime and fill the record with its statistics
+void measureExplosureRecord(explosureRecord& thisRecord, int explosureTime, bool debug = false) {
+  int& thisExplosureTime = thisRecord.explosureTime;
+  int& thisMinVal        = thisRecord.minVal;
+  int& thisMaxVal        = thisRecord.maxVal;
+  int& thisAvgVal        = thisRecord.avgVal;
+  bool& thisIsValid      = thisRecord.isValid;
+  float& thisContrast    = thisRecord.contrast;
 
-    // Capture
-    captrueCCD(thisExplosureTime);
-    captrueCCD(0);
+  thisIsValid       = false;
+  thisExplosureTime = explosureTime;
+
+  if (debug) {
+    Serial.print("explosure time: ");
+    Serial.println(thisExplosureTime);
+  }
 
-    parseLinearVals(thisMinVal, thisMaxVal, thisAvgVal, debug);
-    thisContrast = (thisMaxVal == 0) ? 1 : float(thisMinVal) / float(thisMaxVal);
+  // Capture
+  captrueCCD(thisExplosureTime);
+  captrueCCD(0);
 
-    linearToBinary(thisMinVal, thisMaxVal);
-    int trackMidPixel = getTrackMidPixel();
+  parseLinearVals(thisMinVal, thisMaxVal, thisAvgVal, debug);
+  thisContrast = (thisMaxVal == 0) ? 1 : float(thisMinVal) / float(thisMaxVal);
 
-    if (trackMidPixel != -1) {
-      thisIsValid = true;
+  linearToBinary(thisMinVal, thisMaxVal);
+  int trackMidPixel = getTrackMidPixel();
 
-      if (debug) {
-        drawOneHot(trackMidPixel);
-        printCCDLinearData(thisMaxVal);
-        printCCDBinaryRawData();
-        printCCDOneHotData();
-      }
-    }
+  if (trackMidPixel != -1) {
+    thisIsValid = true;
 
-    if (!thisIsValid && debug)
-      Serial.println("Failed to find threhold for this explosure time!");
+    if (debug) {
+      drawOneHot(trackMidPixel);
+      printCCDLinearData(thisMaxVal);
+      printCCDBinaryRawData();
+      printCCDOneHotData();
+    }
   }
 
-  // Loop through all records and select the one with best contrast (smallest)
+  if (!thisIsValid && debug)
+    Serial.println("Failed to find threhold for this explosure time!");
+}
+
+// loop through all records and select the one with best contrast (smallest), the camera is blocked
+// when no record is valid, or the contrast changes too much along the tested explosure times
+void selectBestExplosureRecord(explosureRecord* records, int recordSize,
+                               explosureRecord& bestRecord, bool& cameraIsBlocked) {
   float minContrast = 1.0f;
   float maxContrast = 0.0f;
 
   for (uint8_t i = 0; i < recordSize; i++) {
     explosureRecord& thisRecord = records[i];
 
-    int& thisExplosureTime = thisRecord.explosureTime;
-    int& thisMinVal        = thisRecord.minVal;
-    int& thisMaxVal        = thisRecord.maxVal;
-    int& thisAvgVal        = thisRecord.avgVal;
-    bool& thisIsValid      = thisRecord.isValid;
-    float& thisContrast    = thisRecord.contrast;
-
-    if (!thisIsValid)
+    if (!thisRecord.isValid)
       continue;
 
     Serial.print("explosure_time: ");
-    Serial.print(thisExplosureTime);
+    Serial.print(thisRecord.explosureTime);
     Serial.print("  contrast: ");
-    Serial.println(thisContrast);
-
-    if (thisContrast < minContrast) {
-      minContrast = thisContrast;
-      {
-        bestRecord.explosureTime = thisExplosureTime;
-        bestRecord.minVal        = thisMinVal;
-        bestRecord.maxVal        = thisMaxVal;
-        bestRecord.avgVal        = thisAvgVal;
-        bestRecord.isValid       = true;
-        bestRecord.contrast      = thisContrast;
-      }
+    Serial.println(thisRecord.contrast);
+
+    if (thisRecord.contrast < minContrast) {
+      minContrast = thisRecord.contrast;
+      bestRecord  = thisRecord;
     }
 
-    if (thisContrast > maxContrast)
-      maxContrast = thisContrast;
+    if (thisRecord.contrast > maxContrast)
+      maxContrast = thisRecord.contrast;
   }
 
   // Output
@@ -349,28 +599,298 @@ void getBestExplosureTime(explosureRecord& bestRecord, bool& cameraIsBlocked, bo
                     (minContrast < 0.02 && maxContrast - minContrast > cMinMaxRatioDeltaBlocked);
 }
 
+// function excecuted once a power-on: get the best explosure time
+// we get the best explosure time by testing every possible explosure time, and find the t with
+// highest contrast (max / min)
+void getBestExplosureTime(explosureRecord& bestRecord, bool& cameraIsBlocked, bool debug = false) {
+  cameraIsBlocked    = false;
+  bestRecord.isValid = false;
+
+  int recordSize = (cExplosureTimeEnd - cExplosureTimeStart) / cExplosureTimePropagation + 1;
+  explosureRecord records[recordSize];
+
+  // Test for each explosuring time
+  for (uint8_t i = 0; i < recordSize; i++)
+    measureExplosureRecord(records[i], cExplosureTimeStart + cExplosureTimePropagation * i, debug);
+
+  selectBestExplosureRecord(records, recordSize, bestRecord, cameraIsBlocked);
+}
+
+// the probes taken by the fast search, each explosure time is measured at most once
+explosureRecord explosureProbes[cExplosureSearchMaxProbes];
+int explosureProbeNum = 0;
+
+// the score to be minimized by the search, a probe without a track is the worst possible one
+float probeExplosure(int explosureTime, bool debug) {
+  for (int i = 0; i < explosureProbeNum; i++) {
+    if (explosureProbes[i].explosureTime == explosureTime)
+      return explosureProbes[i].isValid ? explosureProbes[i].contrast : 1.0f;
+  }
+
+  if (explosureProbeNum == cExplosureSearchMaxProbes)
+    return 1.0f;
+
+  explosureRecord& probe = explosureProbes[explosureProbeNum++];
+  measureExplosureRecord(probe, explosureTime, debug);
+  return probe.isValid ? probe.contrast : 1.0f;
+}
+
+// the fast version of getBestExplosureTime: a golden-section search over the contrast curve, which
+// is unimodal over the explosure range (too dark -> good -> saturated). it probes the times of the
+// sweep only, and only the two inside the bracket the next step needs, a probe is never repeated.
+// once the bracket is two steps wide its middle decides, 4 - 5 probes instead of the 9 of the
+// sweep. the blocked camera detection sees the contrast span of the probes only
+void searchBestExplosureTime(explosureRecord& bestRecord, bool& cameraIsBlocked,
+                             bool debug = false) {
+  const float invPhi = 0.618034f;
+
+  cameraIsBlocked    = false;
+  bestRecord.isValid = false;
+  explosureProbeNum  = 0;
+
+  // the bracket in steps of the tolerance from the start of the range
+  int a = 0;
+  int b = (cExplosureTimeEnd - cExplosureTimeStart) / cExplosureSearchTolerance;
+  while (b - a > 2) {
+    int c = b - customRound((b - a) * invPhi);
+    int d = a + customRound((b - a) * invPhi);
+    if (d <= c)
+      d = c + 1;
+
+    float fc = probeExplosure(cExplosureTimeStart + c * cExplosureSearchTolerance, debug);
+    float fd = probeExplosure(cExplosureTimeStart + d * cExplosureSearchTolerance, debug);
+    if (fc < fd)
+      b = d;
+    else
+      a = c;
+  }
+  for (int i = a; i <= b; i++)
+    probeExplosure(cExplosureTimeStart + i * cExplosureSearchTolerance, debug);
+
+  selectBestExplosureRecord(explosureProbes, explosureProbeNum, bestRecord, cameraIsBlocked);
+}
+
+// calibrate the explosure time with the configured method, and record how much it costs
+void calibrateExplosure(explosureRecord& bestRecord, bool& cameraIsBlocked, bool debug = false) {
+  unsigned long startTimeMs   = millis();
+  unsigned long startCaptures = ccdCaptureCount;
+
+  if (cExplosureFastSearch) {
+    searchBestExplosureTime(bestRecord, cameraIsBlocked, debug);
+  } else {
+    getBestExplosureTime(bestRecord, cameraIsBlocked, debug);
+  }
+
+  explosureCalibrationStats.captures   = ccdCaptureCount - startCaptures;
+  explosureCalibrationStats.durationMs = millis() - startTimeMs;
+
+  Serial.print("explosure calibration: ");
+  Serial.print(explosureCalibrationStats.captures);
+  Serial.print(" captures in ");
+  Serial.print(explosureCalibrationStats.durationMs);
+  Serial.println(" ms");
+}
+
 int lastAvailableAverage = 0;
 
-// the function to fetch track mid pixel, during normal tracking
-void processCCD(int& trackMidPixel, int& tracingStatus, int explosureTime,
-                bool resetAndExplosure = false, bool debug = false) {
+// the threshold and contrast (max - min) of the last frame the track was found in
+int lastTrackedThreshold = 0;
+int lastTrackedContrast  = 0;
 
-  tracingStatus = STATUS_NORMAL;
+// the black / white pixel counts of the last frame, shown on the tracking screen
+int lastBlackNum = 0;
+int lastWhiteNum = 0;
+
+int autoExplosureTime      = 0; // 0 until the controller is seeded by the first processed frame
+int autoExplosureOutFrames = 0; // consecutive frames out of the target band, signed by direction
+
+// closed loop explosure control, fed with the statistics of a frame integrated for
+// frameExplosureTime. the brightness of the frame scales linearly with the explosure time, so the
+// proportional step towards the band centre is a good guess, bounded by cAutoExplosureMaxStep
+void updateAutoExplosure(int frameExplosureTime, int maxVal) {
+  // a frame from before the last adjustment tells nothing about the current setting
+  if (frameExplosureTime != autoExplosureTime || maxVal <= 0)
+    return;
+
+  int saturatedNum = linearHistogram[cLinearHistogramBins - 1];
+  int direction    = 0;
+  if (maxVal > cAutoExplosureTargetHigh || saturatedNum > cAutoExplosureSaturatedMax)
+    direction = -1;
+  else if (maxVal < cAutoExplosureTargetLow)
+    direction = 1;
+
+  // back inside the band, or out on the other side: start counting again
+  if (autoExplosureOutFrames * direction <= 0)
+    autoExplosureOutFrames = 0;
+  if (direction == 0)
+    return;
+
+  autoExplosureOutFrames += direction;
+  if (abs(autoExplosureOutFrames) < cAutoExplosureSettleFrames)
+    return;
+  autoExplosureOutFrames = 0;
+
+  int targetVal = (cAutoExplosureTargetLow + cAutoExplosureTargetHigh) / 2;
+  int step      = autoExplosureTime * targetVal / maxVal - autoExplosureTime;
+  if (step == 0)
+    step = direction;
+  clamp(step, -cAutoExplosureMaxStep, cAutoExplosureMaxStep);
+
+  autoExplosureTime += step;
+  clamp(autoExplosureTime, cAutoExplosureMin, cAutoExplosureMax);
+  ccdPipelineSetExplosure(autoExplosureTime);
+}
+
+// get the frame to be processed into linearData, returns the explosure time it was integrated with
+int acquireCCDFrame(int explosureTime, bool resetAndExplosure) {
+  // the auto explosure takes over from the calibrated explosure time once tracking has started
+  if (cAutoExplosureEnabled) {
+    if (autoExplosureTime == 0) {
+      autoExplosureTime = explosureTime;
+      ccdPipelineSetExplosure(autoExplosureTime);
+    }
+    explosureTime = autoExplosureTime;
+  }
+
+  // Capture, when the pipeline is running the frame has already been read out in the background
+  if (ccdPipelineRunning) {
+    ccdFrame& frame = ccdAcquireFrame(resetAndExplosure);
+    linearData      = frame.linear;
+    return frame.explosureTime;
+  }
 
-  // Capture
   if (resetAndExplosure) {
     captrueCCD(explosureTime);
     captrueCCD(0);
   } else {
     captrueCCD(explosureTime);
   }
+  return explosureTime;
+}
+
+// convert the frame to binary data with the configured method, returns the (global) threshold
+int binarizeCCDFrame(int minVal, int maxVal) {
+  // a flat frame (all platform bar, or all floor) has nothing to split, otsu would cut its noise in
+  // halves. it is compared against the threshold of the last tracked frame instead
+  if (maxVal - minVal < lastTrackedContrast * cFlatFrameContrastPercent / 100)
+    return linearToBinary(minVal, maxVal, lastTrackedThreshold);
+
+  if (cThresholdMode == THRESHOLD_MIDPOINT)
+    return linearToBinary(minVal, maxVal, lastAvailableAverage);
+  if (cThresholdMode == THRESHOLD_OTSU)
+    return linearToBinary(minVal, maxVal, otsuThreshold(minVal, maxVal));
+
+  int threshold = otsuThreshold(minVal, maxVal);
+  linearToBinaryAdaptive(minVal, maxVal, threshold);
+  return threshold;
+}
+
+// split the counting window into its dark and light runs, with a single pass over the pixels (the
+// run borders are found a word at a time). the contrast of a segment is the mean of its neighbours
+// minus its own mean, so it is positive for a dark run on light ground
+void extractSegments(ccdSegmentList& list) {
+  list.count    = 0;
+  list.overflow = false;
+
+  int pos = cCountStart;
+  while (pos <= cCountEnd) {
+    bool dark = binaryLineGet(binaryData, pos);
+    int end   = min(binaryLineNext(binaryData, pos, !dark) - 1, cCountEnd);
+
+    if (list.count == cMaxSegments) {
+      list.overflow = true;
+      break;
+    }
+
+    long sum = 0;
+    for (int i = pos; i <= end; i++)
+      sum += linearData[i];
+
+    ccdSegment& segment = list.segments[list.count++];
+    segment.start       = pos;
+    segment.end         = end;
+    segment.dark        = dark;
+    segment.meanVal     = sum / (end - pos + 1);
+
+    pos = end + 1;
+  }
+
+  for (int s = 0; s < list.count; s++) {
+    int neighbourSum = 0, neighbourNum = 0;
+    if (s > 0) {
+      neighbourSum += list.segments[s - 1].meanVal;
+      neighbourNum++;
+    }
+    if (s + 1 < list.count) {
+      neighbourSum += list.segments[s + 1].meanVal;
+      neighbourNum++;
+    }
+
+    list.segments[s].contrast =
+        (neighbourNum == 0) ? 0 : neighbourSum / neighbourNum - list.segments[s].meanVal;
+  }
+}
+
+// feed the black pixel count of this frame to the platform detector, returns true while the
+// platform is confirmed. platformFrame tells whether this frame alone looks like a platform. the
+// time between the frames is that of their readouts when the pipeline runs
+bool detectPlatform(int blackNum, int totalNum, bool& platformFrame) {
+  float blackRatio = float(blackNum) / float(max(totalNum, 1));
+  platformFrame    = blackRatio > cPlatformEnterRatio;
+
+  unsigned long frameMs = ccdPipelineRunning ? ccdFrames[ccdFrontFrame].timestampMs : millis();
+  unsigned long sinceMs = (platformLastFrameMs == 0) ? 0 : frameMs - platformLastFrameMs;
+  platformLastFrameMs   = frameMs;
+  float travel          = platformGroundSpeed * sinceMs / encoder_ticks_per_m;
+  return platformWatch.update(blackRatio, travel) == platformDetector::CONFIRMED;
+}
+
+// the segment variant of processCCD: instead of reducing the frame to one track centre, every run
+// is handed out, so junctions, parallel lines, platform bars and noise can be told apart by the
+// caller. the status follows the same rules as processCCD
+void processCCDSegments(ccdSegmentList& segments, int& tracingStatus, int explosureTime,
+                        bool resetAndExplosure = false) {
+  tracingStatus = STATUS_NORMAL;
+
+  acquireCCDFrame(explosureTime, resetAndExplosure);
+
+  int minVal, maxVal, avgVal;
+  parseLinearVals(minVal, maxVal, avgVal);
+  binarizeCCDFrame(minVal, maxVal);
+  extractSegments(segments);
+
+  int blackNum = 0, widestDark = 0;
+  for (int s = 0; s < segments.count; s++) {
+    const ccdSegment& segment = segments.segments[s];
+    if (!segment.dark)
+      continue;
+    blackNum += segment.end - segment.start + 1;
+    widestDark = max(widestDark, segment.end - segment.start + 1);
+  }
+
+  bool platformFrame;
+  if (detectPlatform(blackNum, cCountEnd - cCountStart + 1, platformFrame))
+    tracingStatus = STATUS_PLATFORM;
+  else if (platformFrame || widestDark < cEffectiveLineWidthMin)
+    tracingStatus = STATUS_NO_TRACK;
+}
+
+// the function to fetch track mid pixel from one frame, returns the threshold the frame was
+// binarized with. the ascii debug dumps are skipped while the telemetry streams the frames
+int trackCCDFrame(float& trackMidPixel, int& tracingStatus, int explosureTime,
+                  bool resetAndExplosure, bool debug) {
+
+  tracingStatus = STATUS_NORMAL;
+
+  int frameExplosureTime = acquireCCDFrame(explosureTime, resetAndExplosure);
 
   // get min max avg values
   int minVal, maxVal, avgVal;
   parseLinearVals(minVal, maxVal, avgVal, debug);
   // use the values obtained above to convert the linear value to binary
-  linearToBinary(minVal, maxVal, lastAvailableAverage);
+  int threshold = binarizeCCDFrame(minVal, maxVal);
 
+  debug = debug && !ccdTelemetryRunning;
   if (debug) {
     printCCDLinearData(maxVal);
     printCCDBinaryRawData();
@@ -380,34 +900,69 @@ void processCCD(int& trackMidPixel, int& tracingStatus, int explosureTime,
   int blackNum, whiteNum, totalNum;
   parseBinaryVals(blackNum, whiteNum, totalNum);
 
-  oledPrint("bl", blackNum, "wh", whiteNum, 2);
+  lastBlackNum = blackNum;
+  lastWhiteNum = whiteNum;
 
   // the discriminant condition whether the binary value indicate a solid black line, if so, the
-  // tracing status is platform
-  if (blackNum > int(totalNum * 0.7f)) {
+  // tracing status is platform. a single mostly black frame is not trusted, it is dropped as
+  // NO_TRACK (and bridged by the track filter) until the detector has confirmed the platform
+  bool platformFrame;
+  if (detectPlatform(blackNum, totalNum, platformFrame)) {
+    roiSeedPixel  = -1; // the line behind a platform may be anywhere
     tracingStatus = STATUS_PLATFORM;
-    return;
+    return threshold;
+  }
+  if (platformFrame) {
+    tracingStatus = STATUS_NO_TRACK;
+    return threshold;
   }
 
-  trackMidPixel = getTrackMidPixel();
+  // platform frames are mostly black, they would push the explosure up for nothing
+  if (cAutoExplosureEnabled)
+    updateAutoExplosure(frameExplosureTime, maxVal);
 
-  if (trackMidPixel != -1 && debug)
-    drawOneHot(trackMidPixel);
+  int trackLeftPixel, trackRightPixel;
 
-  // fail to find the track mid pixel from the binary array, this means the track condition here is
-  // ambiguous
-  if (trackMidPixel == -1) {
-    tracingStatus = STATUS_NO_TRACK;
-    return;
+  // fail to find the track from the binary array, this means the track condition here is ambiguous
+  if (!findTrackRun(trackLeftPixel, trackRightPixel)) {
+    lastTrackEstimate.centreQ8 = -1;
+    tracingStatus              = STATUS_NO_TRACK;
+    return threshold;
   }
 
+  estimateTrackCentre(trackLeftPixel, trackRightPixel, threshold, maxVal - minVal,
+                      lastTrackEstimate);
+  trackMidPixel = float(lastTrackEstimate.centreQ8) / float(1 << cSubPixelShift);
+  roiSeedPixel  = lastTrackEstimate.centreQ8 >> cSubPixelShift;
+
+  if (debug)
+    drawOneHot(customRound(trackMidPixel));
+
   // if (lastAvailableAverage == 0)
   lastAvailableAverage = avgVal;
+  lastTrackedThreshold = threshold;
+  lastTrackedContrast  = maxVal - minVal;
 
   if (debug)
     printCCDOneHotData();
 
-  // Pixel mapping
-  trackMidPixel =
-      customRound(map(float(trackMidPixel), float(cCountStart), float(cCountEnd), 0.0f, 128.0f));
+  // Pixel mapping, the fraction is kept so the pid sees a smooth error
+  trackMidPixel = map(trackMidPixel, float(cCountStart), float(cCountEnd), 0.0f, 128.0f);
+  return threshold;
+}
+
+// the function to fetch track mid pixel, during normal tracking. every processed frame is also
+// handed to the sensor log and the telemetry stream, which are no-ops unless they have been started
+void processCCD(float& trackMidPixel, int& tracingStatus, int explosureTime,
+                bool resetAndExplosure = false, bool debug = false) {
+  int threshold =
+      trackCCDFrame(trackMidPixel, tracingStatus, explosureTime, resetAndExplosure, debug);
+
+  const ccdFrame& frame = ccdFrames[ccdFrontFrame];
+  sensorLogFrame(frame.seq, frame.explosureTime, linearData);
+
+  int centreQ8          = (tracingStatus == STATUS_NORMAL) ? lastTrackEstimate.centreQ8 : -1;
+  uint8_t flags         = platformWatch.isApproaching() ? cCCDTelemetryApproach : 0;
+  ccdTelemetryPush(tracingStatus, frame.seq, frame.timestampMs, frame.explosureTime, threshold,
+                   centreQ8, flags, linearData);
 }
\ No newline at end of file
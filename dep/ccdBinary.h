@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// the binarized ccd line packed into 128 bits, bit i of the line is bit (i & 31) of word (i >> 5),
+// a set bit means a dark pixel. a whole line fits into four registers, so counting and run
+// searching can be done a word at a time with popcount / count-trailing-zeros instead of a branch
+// per pixel
+
+const int cBinaryLineBits  = 128;
+const int cBinaryLineWords = cBinaryLineBits / 32;
+
+struct binaryLine {
+  uint32_t words[cBinaryLineWords];
+};
+
+inline void binaryLineClear(binaryLine& line) {
+  for (int w = 0; w < cBinaryLineWords; w++)
+    line.words[w] = 0;
+}
+
+inline bool binaryLineGet(const binaryLine& line, int i) {
+  return (line.words[i >> 5] >> (i & 31)) & 1u;
+}
+
+inline int binaryLinePopcount(const binaryLine& line) {
+  int count = 0;
+  for (int w = 0; w < cBinaryLineWords; w++)
+    count += __builtin_popcount(line.words[w]);
+  return count;
+}
+
+// the bits of [start, end] that fall into word w
+inline uint32_t binaryLineWindow(int w, int start, int end) {
+  int lo = start - (w << 5), hi = end - (w << 5);
+  if (lo > 31 || hi < 0 || lo > hi)
+    return 0;
+  return (~0u >> (31 - (hi > 31 ? 31 : hi))) & (~0u << (lo < 0 ? 0 : lo));
+}
+
+// four pixels compared at once, a byte each: the high bit of a byte of the result is set where the
+// pixel is below the threshold, i.e. where pixel - threshold borrows. the bytes are subtracted
+// without borrowing from each other (hacker's delight 2-18), the borrow out of each is then taken
+// from its sign bits
+inline uint32_t binaryDarkBytes(uint32_t pixels, uint32_t thresholds) {
+  const uint32_t high = 0x80808080u;
+  uint32_t diff = ((pixels | high) - (thresholds & ~high)) ^ ((pixels ^ ~thresholds) & high);
+  return ((~pixels & thresholds) | (~(pixels ^ thresholds) & diff)) & high;
+}
+
+// compare-and-pack four pixels per step: pixels in [start, end] darker than the threshold become
+// set bits, everything outside of the window stays 0. the flags of the four bytes are gathered into
+// four bits with a multiply, byte k is shifted into bit 21 + k and nothing else lands there. the
+// pixels are loaded as little endian words, as the esp32 and the host are
+inline void binaryLinePack(const uint8_t* linear, int threshold, int start, int end,
+                           binaryLine& line) {
+  // no pixel is below 0, every one is below 256
+  bool compare        = threshold > 0 && threshold <= 255;
+  uint32_t fill       = (threshold > 255) ? ~0u : 0;
+  uint32_t threshold4 = uint32_t(threshold & 0xff) * 0x01010101u;
+
+  for (int w = 0; w < cBinaryLineWords; w++) {
+    uint32_t word = fill;
+    for (int q = 0; compare && q < 32; q += 4) {
+      uint32_t pixels;
+      memcpy(&pixels, linear + (w << 5) + q, sizeof(pixels));
+      uint32_t dark = binaryDarkBytes(pixels, threshold4) >> 7;
+      word |= (((dark * 0x00204081u) >> 21) & 0xfu) << q;
+    }
+    line.words[w] = word & binaryLineWindow(w, start, end);
+  }
+}
+
+// index of the first bit >= from which equals `dark`, or cBinaryLineBits if there is none
+inline int binaryLineNext(const binaryLine& line, int from, bool dark) {
+  if (from >= cBinaryLineBits)
+    return cBinaryLineBits;
+
+  int w         = from >> 5;
+  uint32_t word = (dark ? line.words[w] : ~line.words[w]) & (~0u << (from & 31));
+
+  while (word == 0) {
+    if (++w == cBinaryLineWords)
+      return cBinaryLineBits;
+    word = dark ? line.words[w] : ~line.words[w];
+  }
+
+  return (w << 5) + __builtin_ctz(word);
+}
+
+// find the first dark run starting at or after `from` that is at least minWidth pixels wide,
+// returns false if there is none. bits past `end` are treated as light
+inline bool binaryLineFindRun(const binaryLine& line, int from, int end, int minWidth,
+                              int& runLeft, int& runRight) {
+  int pos = from;
+
+  while (pos <= end) {
+    int left = binaryLineNext(line, pos, true);
+    if (left > end)
+      return false;
+
+    int right = binaryLineNext(line, left, false) - 1;
+    if (right > end)
+      right = end;
+
+    if (right - left + 1 >= minWidth) {
+      runLeft  = left;
+      runRight = right;
+      return true;
+    }
+
+    pos = right + 1;
+  }
+
+  return false;
+}
@@ -0,0 +1,384 @@
+#pragma once
+
+#include "../args.h"
+#include "hal.h"
+#include "pinouts.h"
+
+// the capture engine clocks one full frame (128 pixels) out of the TSL1401 into a buffer, three
+// backends are available:
+// - CCD_DMA_ON (args.h): SI / CLK are generated by hardware (LEDC), AO is sampled by the i2s adc
+//   into a dma buffer, the cpu only sleeps until the dma is done and finds the readout in the
+//   samples
+// - default: the classic bit-banged readout
+// - host build (no ARDUINO): recorded frames are replayed from a text file, so the ccd pipeline
+//   can be fed with real data on linux
+//
+// a readout is split in two: ccdStartReadout() fires SI and the clock that latches it, and
+// ccdFinishReadout() clocks the rest of the frame out. ccdFireShutter() fires SI and runs a whole
+// readout without reading it, which dumps the charge and starts a fresh integration: the
+// integration time is set apart from the frame period with it. the two that fire SI only write the
+// SI / CLK pins and the clock registers, they run in the timer interrupts of ccdPipeline.h
+
+const int cCCDFramePixels = 128;
+const int cCCDAdcBits     = 8; // the adc is configured once to 8 bits, a frame is 128 bytes
+const int cCCDAdcMax      = (1 << cCCDAdcBits) - 1;
+
+// the TSL1401 starts integrating the next frame on the 18th clock of a readout, counted from the
+// one that latches SI
+const int cCCDIntegrationStartClock = 18;
+const int cCCDClockCycles           = cCCDFramePixels + 1; // the 129th clock ends the readout
+
+// micros() of the last integration start and of the last SI that started a readout, and of the
+// integration start of the frame that SI ended. kept by the backends
+volatile unsigned long ccdIntegrationStartUs        = 0;
+volatile unsigned long ccdReadoutStartUs            = 0;
+volatile unsigned long ccdReadoutIntegrationStartUs = 0;
+
+// per-pixel dark / flat field correction, applied by every backend in the same pass that stores the
+// samples: corrected = (raw - offset) * gain, the gain is Q12 (4096 = 1.0). the tables are made by
+// ccdFlatField.h and kept in nvs by ccdStorage.h
+const int cCCDGainShift = 12;
+const int cCCDGainOne   = 1 << cCCDGainShift;
+
+struct ccdCorrectionTable {
+  uint8_t offset[cCCDFramePixels];
+  uint16_t gain[cCCDFramePixels];
+};
+
+ccdCorrectionTable ccdCorrection{};
+bool ccdCorrectionEnabled = false;
+
+inline int ccdCorrectPixel(int i, int raw) {
+  int val = ((raw - int(ccdCorrection.offset[i])) * int(ccdCorrection.gain[i])) >> cCCDGainShift;
+  return (val < 0) ? 0 : (val > cCCDAdcMax ? cCCDAdcMax : val);
+}
+
+// the i2s adc stream of the dma backend. the adc samples AO cCCDOversample times per pixel clock
+// and runs freely, neither the phase of its samples to the CLK edges nor the sample the first edge
+// falls on is known. AO is idle between two readouts (the sensor lets it go after the 129th clock),
+// a capture of the stream starts with idle samples, up to cCCDLeadCycles pixel clocks of them. the
+// esp32 i2s adc stores the 16 bit samples of a 32 bit word swapped, sample k is at [k ^ 1]. shared
+// with the host, the alignment is checked on made up streams there
+const int cCCDOversample   = 4; // i2s adc samples per pixel clock
+const int cCCDSampleOffset = 2; // sample picked inside each pixel clock, half way to the next edge
+const int cCCDLeadCycles   = 32; // pixel clocks of idle samples a capture may start with, at most
+const int cCCDSampleCount  = (cCCDClockCycles + cCCDLeadCycles) * cCCDOversample;
+const int cCCDI2SAdcShift  = 12 - cCCDAdcBits;
+
+inline int ccdStreamSample(const uint16_t* samples, int k) { return samples[k ^ 1]; }
+
+// the first sample of pixel 0 in a capture of count samples. AO steps to the next pixel at every
+// rising CLK edge, so the steps between samples gather in one phase of cCCDOversample: the pixels
+// start in that phase. of the starts in that phase, the readout is the window of cCCDFramePixels
+// pixels furthest from the idle level of the first sample. a frame without steps has no phase to
+// find, nor does it need one, all its pixels are alike
+int ccdFindReadoutStart(const uint16_t* samples, int count) {
+  long steps[cCCDOversample] = {};
+  for (int k = 1; k < count; k++)
+    steps[k % cCCDOversample] += abs(ccdStreamSample(samples, k) - ccdStreamSample(samples, k - 1));
+
+  int phase = 0;
+  for (int p = 1; p < cCCDOversample; p++) {
+    if (steps[p] > steps[phase])
+      phase = p;
+  }
+
+  // the distance of the window from idle is slid along a pixel at a time
+  const int window = cCCDFramePixels * cCCDOversample;
+  int idle         = ccdStreamSample(samples, 0);
+  long distance    = 0;
+  for (int i = 0; i < cCCDFramePixels; i++)
+    distance += abs(ccdStreamSample(samples, phase + i * cCCDOversample + cCCDSampleOffset) - idle);
+
+  int best          = phase;
+  long bestDistance = distance;
+  for (int start = phase + cCCDOversample; start + window <= count; start += cCCDOversample) {
+    distance -= abs(ccdStreamSample(samples, start - cCCDOversample + cCCDSampleOffset) - idle);
+    distance += abs(ccdStreamSample(samples, start + window - cCCDOversample + cCCDSampleOffset) -
+                    idle);
+    if (distance > bestDistance) {
+      best         = start;
+      bestDistance = distance;
+    }
+  }
+  return best;
+}
+
+// the frame of a capture of the stream, read out from its first sample start: one sample in the
+// middle of every pixel clock, narrowed from the 12 bits of the i2s adc to the frame's 8
+void ccdFrameFromStream(const uint16_t* samples, int start, uint8_t* frame) {
+  if (ccdCorrectionEnabled) {
+    for (int i = 0; i < cCCDFramePixels; i++) {
+      int sample = ccdStreamSample(samples, start + i * cCCDOversample + cCCDSampleOffset);
+      frame[i]   = ccdCorrectPixel(i, sample >> cCCDI2SAdcShift);
+    }
+  } else {
+    for (int i = 0; i < cCCDFramePixels; i++)
+      frame[i] = ccdStreamSample(samples, start + i * cCCDOversample + cCCDSampleOffset) >>
+                 cCCDI2SAdcShift;
+  }
+}
+
+#ifdef ARDUINO
+
+#include "soc/gpio_struct.h"
+
+// SI and CLK are written to the gpio set / clear registers directly, nothing of it runs from flash
+// and it is safe in an interrupt. both pins are below 32
+inline void IRAM_ATTR ccdPinHigh(int pin) { GPIO.out_w1ts = 1u << pin; }
+inline void IRAM_ATTR ccdPinLow(int pin) { GPIO.out_w1tc = 1u << pin; }
+
+#endif
+
+#if !defined(ARDUINO)
+
+#include <cstdio>
+#include <cstdlib>
+
+const int cCCDReplayDefaultVal = 128;
+
+FILE* ccdReplayFile               = nullptr;
+unsigned long ccdReplayFrameCount = 0;
+
+// a host program can supply the frames itself (e.g. the sensor log replay), it takes precedence
+// over the recorded frame file
+void (*ccdReplaySource)(uint8_t* frame) = nullptr;
+
+// open a recorded frame file, each frame is a line of 128 space separated 8-bit pixel values, the
+// file is rewound when the end is reached
+bool ccdReplayOpen(const char* path) {
+  if (ccdReplayFile)
+    fclose(ccdReplayFile);
+  ccdReplayFile       = fopen(path, "r");
+  ccdReplayFrameCount = 0;
+  return ccdReplayFile != nullptr;
+}
+
+void initCCDCapture() {
+  const char* path = getenv("CCD_REPLAY_FILE");
+  if (path)
+    ccdReplayOpen(path);
+}
+
+// read the next recorded frame, a flat frame is returned if no recording is opened
+void ccdCaptureFrame(uint8_t* frame) {
+  for (int i = 0; i < cCCDFramePixels; i++)
+    frame[i] = cCCDReplayDefaultVal;
+
+  if (ccdReplaySource) {
+    ccdReplaySource(frame);
+    ccdReplayFrameCount++;
+    return;
+  }
+
+  if (!ccdReplayFile)
+    return;
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int i = 0, val;
+    while (i < cCCDFramePixels && fscanf(ccdReplayFile, "%d", &val) == 1)
+      frame[i++] = (val < 0) ? 0 : (val > cCCDAdcMax ? cCCDAdcMax : val);
+
+    if (i == cCCDFramePixels) {
+      if (ccdCorrectionEnabled) {
+        for (int j = 0; j < cCCDFramePixels; j++)
+          frame[j] = ccdCorrectPixel(j, frame[j]);
+      }
+      ccdReplayFrameCount++;
+      return;
+    }
+
+    // reached the end (or a broken line), start over from the first frame
+    rewind(ccdReplayFile);
+  }
+}
+
+// there is nothing to clock, the whole frame is read in ccdFinishReadout
+void ccdStartReadout() {
+  ccdReadoutIntegrationStartUs = ccdIntegrationStartUs;
+  ccdReadoutStartUs            = micros();
+}
+void ccdFireShutter() { ccdIntegrationStartUs = micros(); }
+void ccdFinishReadout(uint8_t* frame) { ccdCaptureFrame(frame); }
+
+#elif defined(CCD_DMA_ON)
+
+#include "../lib/arduino-esp32/libraries/I2S/src/I2S.h"
+#include "soc/ledc_struct.h"
+
+#define PWM_CHANNEL_CCD_CLK 6 // timer 3, not shared with the servo or the motors
+
+const int cCCDPixelClockHz     = 100000; // 10us per pixel, same as the bit-banged version
+const int cCCDPixelClockUs     = 1000000 / cCCDPixelClockHz;
+const int cCCDDmaBufferSamples = 64; // the latency of the stream, well inside cCCDLeadCycles
+
+// the LEDC timer the arduino core gives PWM_CHANNEL_CCD_CLK: high speed group, (6 / 2) % 4
+const int cCCDClockGroup = 0;
+const int cCCDClockTimer = 3;
+
+uint16_t ccdSampleBuffer[cCCDSampleCount];
+
+// the i2s adc and the LEDC clock run continuously, the clock is on the CLK pin all the time: the
+// sensor ignores the clocks after the 129th until the next SI
+void initCCDCapture() {
+  pinMode(PINOUT_CCD_SI, OUTPUT);
+  digitalWrite(PINOUT_CCD_SI, LOW);
+
+  ledcSetup(PWM_CHANNEL_CCD_CLK, cCCDPixelClockHz, 1); // 1 bit resolution, duty 1 = 50%
+  ledcWrite(PWM_CHANNEL_CCD_CLK, 1);
+  ledcAttachPin(PINOUT_CCD_CLK, PWM_CHANNEL_CCD_CLK);
+
+  I2S.setDataInPin(PINOUT_CCD_AO);
+  I2S.setBufferSize(cCCDDmaBufferSamples);
+  if (!I2S.begin(ADC_DAC_MODE, cCCDPixelClockHz * cCCDOversample, 16))
+    Serial.println("ccd: failed to start i2s adc");
+}
+
+// drop count samples of the stream
+void ccdSkipSamples(long count) {
+  while (count > 0) {
+    long bytes = min(count * 2, long(sizeof(ccdSampleBuffer)));
+    int n      = I2S.read(ccdSampleBuffer, bytes);
+    if (n <= 0)
+      break;
+    count -= n / 2;
+  }
+}
+
+// SI, latched by the next rising CLK edge. the clock timer is restarted at the start of its high
+// half right after SI goes up, that is the edge, and the others follow at the pixel clock: the
+// integration start is known from the time of SI alone. should an edge of the running clock fall
+// between the two writes, SI is latched a pixel clock early, which the readout search absorbs.
+// returns micros() of the edge
+inline unsigned long IRAM_ATTR ccdFireSI() {
+  ccdPinHigh(PINOUT_CCD_SI);
+  LEDC.timer_group[cCCDClockGroup].timer[cCCDClockTimer].conf.rst = 1;
+  LEDC.timer_group[cCCDClockGroup].timer[cCCDClockTimer].conf.rst = 0;
+  unsigned long edgeUs = micros();
+  ccdPinLow(PINOUT_CCD_SI);
+
+  ccdIntegrationStartUs = edgeUs + (cCCDIntegrationStartClock - 1) * cCCDPixelClockUs;
+  return edgeUs;
+}
+
+void IRAM_ATTR ccdStartReadout() {
+  ccdReadoutIntegrationStartUs = ccdIntegrationStartUs;
+  ccdReadoutStartUs            = ccdFireSI();
+}
+
+// the running clock reads the frame out, unread
+void IRAM_ATTR ccdFireShutter() { ccdFireSI(); }
+
+void ccdFinishReadout(uint8_t* frame) {
+  // the ring still holds the samples from before SI. all but a pixel clock of them are dropped,
+  // give or take the samples still in the dma buffer: the capture starts with some idle ones
+  long sinceUs = micros() - ccdReadoutStartUs;
+  long taken   = sinceUs * (cCCDPixelClockHz / 1000) * cCCDOversample / 1000;
+  ccdSkipSamples(I2S.available() / 2 - taken - cCCDOversample);
+
+  // the task blocks on the i2s ring buffer here, the cpu is free while the dma fills it
+  size_t got = 0;
+  while (got < sizeof(ccdSampleBuffer)) {
+    int n = I2S.read(reinterpret_cast<uint8_t*>(ccdSampleBuffer) + got,
+                     sizeof(ccdSampleBuffer) - got);
+    if (n <= 0)
+      break;
+    got += n;
+  }
+
+  // the adc is not in step with the clock, the readout is found in the samples
+  ccdFrameFromStream(ccdSampleBuffer, ccdFindReadoutStart(ccdSampleBuffer, got / 2), frame);
+}
+
+void ccdCaptureFrame(uint8_t* frame) {
+  ccdStartReadout();
+  ccdFinishReadout(frame);
+}
+
+#else
+
+void initCCDCapture() {
+  pinMode(PINOUT_CCD_SI, OUTPUT);
+  pinMode(PINOUT_CCD_CLK, OUTPUT);
+  pinMode(PINOUT_CCD_AO, INPUT);
+
+  digitalWrite(PINOUT_CCD_SI, LOW);  // IDLE state
+  digitalWrite(PINOUT_CCD_CLK, LOW); // IDLE state
+
+  analogReadResolution(cCCDAdcBits);
+}
+
+// the cpu runs at 240 MHz, a slower one only waits longer. SI and CLK need 20 ns of setup and hold,
+// the clock may run at up to 8 MHz: the shutter clocks at 4 MHz
+const uint32_t cCCDSettleCycles    = 60; // 250 ns
+const uint32_t cCCDHalfClockCycles = 30; // 125 ns
+
+// a busy wait on the cpu cycle counter, a register: safe in an interrupt
+inline void IRAM_ATTR ccdWaitCycles(uint32_t cycles) {
+  uint32_t start, now;
+  __asm__ __volatile__("rsr %0, ccount" : "=a"(start));
+  do {
+    __asm__ __volatile__("rsr %0, ccount" : "=a"(now));
+  } while (now - start < cycles);
+}
+
+// SI pulse, latched by the first clock: ends the integration of the frame to be read out
+inline void IRAM_ATTR ccdFireSI() {
+  ccdPinLow(PINOUT_CCD_CLK);
+  ccdWaitCycles(cCCDSettleCycles);
+  ccdPinHigh(PINOUT_CCD_SI);
+  ccdWaitCycles(cCCDSettleCycles);
+
+  ccdPinHigh(PINOUT_CCD_CLK);
+  ccdWaitCycles(cCCDSettleCycles);
+  ccdPinLow(PINOUT_CCD_SI);
+  ccdWaitCycles(cCCDSettleCycles);
+
+  ccdPinLow(PINOUT_CCD_CLK);
+  ccdWaitCycles(cCCDSettleCycles);
+}
+
+void IRAM_ATTR ccdStartReadout() {
+  ccdReadoutIntegrationStartUs = ccdIntegrationStartUs;
+  ccdFireSI();
+  ccdReadoutStartUs = micros();
+}
+
+// the readout of a frame that is thrown away, as fast as the sensor takes it: about 40 us
+void IRAM_ATTR ccdFireShutter() {
+  ccdFireSI();
+  for (int clock = 2; clock <= cCCDClockCycles; clock++) {
+    if (clock == cCCDIntegrationStartClock)
+      ccdIntegrationStartUs = micros();
+    ccdPinHigh(PINOUT_CCD_CLK);
+    ccdWaitCycles(cCCDHalfClockCycles);
+    ccdPinLow(PINOUT_CCD_CLK);
+    ccdWaitCycles(cCCDHalfClockCycles);
+  }
+}
+
+// bit-banged readout: the cpu clocks every pixel and waits for every adc conversion, pixel i is
+// clocked by clock i + 2
+void ccdFinishReadout(uint8_t* frame) {
+  for (int i = 0; i < cCCDFramePixels; i++) {
+    if (i + 2 == cCCDIntegrationStartClock)
+      ccdIntegrationStartUs = micros();
+    digitalWrite(PINOUT_CCD_CLK, HIGH);
+
+    delayMicroseconds(2);
+    int raw  = analogRead(PINOUT_CCD_AO); // 8-bit is enough, see initCCDCapture
+    frame[i] = ccdCorrectionEnabled ? ccdCorrectPixel(i, raw) : raw;
+    digitalWrite(PINOUT_CCD_CLK, LOW);
+    delayMicroseconds(2);
+  }
+
+  digitalWrite(PINOUT_CCD_CLK, HIGH);
+  delayMicroseconds(2);
+}
+
+void ccdCaptureFrame(uint8_t* frame) {
+  ccdStartReadout();
+  ccdFinishReadout(frame);
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ccd.h"
+#include "oled.h"
+
+// Flat field calibration: the sensor is covered to capture the dark frames (per-pixel offset), then
+// held over a plain white surface to capture the flat frames (per-pixel gain), so that vignetting
+// and the fixed pattern noise of the pixels no longer bend the binarization at the window edges
+const int cFlatFieldFrames          = 8;  // frames averaged for each table
+const int cFlatFieldDarkExplosure   = 0;  // read out right after clearing
+const int cFlatFieldFlatExplosure   = 60; // ms, the white target should not saturate
+const int cFlatFieldSignalMin       = 4;  // pixels with less flat signal than this keep a gain of 1
+const int cFlatFieldGainMin         = cCCDGainOne / 2;
+const int cFlatFieldGainMax         = cCCDGainOne * 2;
+const int cFlatFieldPromptCountdown = 1000;
+
+int flatFieldDark[cNumPixels]{};
+int flatFieldFlat[cNumPixels]{};
+ccdCorrectionTable flatFieldTable{};
+
+// average cFlatFieldFrames uncorrected frames, each integrated for explosureTime
+void captureAverageFrame(int explosureTime, int* average) {
+  bool correctionWasEnabled = ccdCorrectionEnabled;
+  ccdCorrectionEnabled      = false;
+
+  memset(average, 0, sizeof(int) * cNumPixels);
+  for (int f = 0; f < cFlatFieldFrames; f++) {
+    captrueCCD(explosureTime);
+    captrueCCD(0);
+    for (int i = 0; i < cNumPixels; i++)
+      average[i] += linearData[i];
+  }
+  for (int i = 0; i < cNumPixels; i++)
+    average[i] /= cFlatFieldFrames;
+
+  ccdCorrectionEnabled = correctionWasEnabled;
+}
+
+// the offset is the dark frame, the gain brings every pixel's flat signal to the mean flat signal
+// of the counting window. returns false when the flat frames are too dark to be used
+bool buildCorrectionTable(const int* dark, const int* flat, ccdCorrectionTable& table) {
+  long signalSum = 0;
+  for (int i = cCountStart; i <= cCountEnd; i++)
+    signalSum += max(flat[i] - dark[i], 0);
+  int meanSignal = signalSum / (cCountEnd - cCountStart + 1);
+
+  if (meanSignal < cFlatFieldSignalMin)
+    return false;
+
+  for (int i = 0; i < cNumPixels; i++) {
+    int signal = flat[i] - dark[i];
+    int offset = dark[i];
+    int gain   = cCCDGainOne;
+    if (signal >= cFlatFieldSignalMin)
+      gain = meanSignal * cCCDGainOne / signal;
+
+    table.offset[i] = clamp(offset, 0, cCCDAdcMax);
+    table.gain[i]   = clamp(gain, cFlatFieldGainMin, cFlatFieldGainMax);
+  }
+
+  return true;
+}
+
+// the calibration procedure, guided on the oled, the new table is enabled right away
+bool calibrateFlatField() {
+  oledPrintAndFlush("COVER CCD", 1);
+  oledCountdown("Dark", cFlatFieldPromptCountdown, 2);
+  captureAverageFrame(cFlatFieldDarkExplosure, flatFieldDark);
+
+  oledPrintAndFlush("WHITE TARGET", 1);
+  oledCountdown("Flat", cFlatFieldPromptCountdown, 2);
+  captureAverageFrame(cFlatFieldFlatExplosure, flatFieldFlat);
+
+  if (!buildCorrectionTable(flatFieldDark, flatFieldFlat, flatFieldTable)) {
+    oledPrintAndFlush("FLAT FAILED", 1);
+    Serial.println("flat field: target too dark, correction unchanged");
+    return false;
+  }
+
+  ccdCorrection        = flatFieldTable;
+  ccdCorrectionEnabled = true;
+  oledPrintAndFlush("FLAT OK", 1);
+  Serial.println("flat field: correction table updated");
+  return true;
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <atomic>
+
+#include "ccdCapture.h"
+
+// the frame pipeline is a triple buffer between the capture task (producer, core 0) and the
+// tracking loop (consumer, core 1). the producer always owns a back frame to read out into, the
+// consumer owns the front frame it is processing, and the middle frame is handed over with a single
+// atomic exchange. frame N+1 is therefore integrated and read out while frame N is binarized and
+// tracked, and the frame rate is bound by the explosure time only
+
+struct ccdFrame {
+  alignas(4) uint8_t linear[cCCDFramePixels]; // 128 bytes, the kernels read it a word at a time
+  unsigned long seq;
+  unsigned long timestampMs;
+  int explosureTime;
+};
+
+const uint8_t cCCDFrameFreshBit   = 0x4; // set on the middle index when it holds an unread frame
+const int cCCDCaptureTaskStack    = 2048;
+const int cCCDCaptureTaskPriority = 3; // above Task1 and Task2, the readout follows the timer
+const int cCCDFrameWaitTimeoutMs  = 200;
+
+ccdFrame ccdFrames[3]{};
+std::atomic<uint8_t> ccdMiddleFrame{1};
+uint8_t ccdBackFrame  = 0; // owned by the producer
+uint8_t ccdFrontFrame = 2; // owned by the consumer
+
+std::atomic<unsigned long> ccdCapturedSeq{0};
+std::atomic<int> ccdPipelineExplosureTime{0};
+bool ccdPipelineRunning = false;
+
+// producer side: hand the freshly captured back frame over, and take the old middle one back
+void ccdPublishFrame() {
+  uint8_t prev = ccdMiddleFrame.exchange(ccdBackFrame | cCCDFrameFreshBit);
+  ccdBackFrame = prev & ~cCCDFrameFreshBit;
+}
+
+// consumer side: swap the front frame with the middle one if a new frame is waiting there
+bool ccdTakeFrame() {
+  if (!(ccdMiddleFrame.load() & cCCDFrameFreshBit))
+    return false;
+
+  uint8_t prev  = ccdMiddleFrame.exchange(ccdFrontFrame);
+  ccdFrontFrame = prev & ~cCCDFrameFreshBit;
+  return true;
+}
+
+// timing statistics of the timer locked capture (all zero on the host), the jitter is the deviation
+// of the measured period between two integration starts from the configured frame period
+struct ccdFrameTiming {
+  unsigned long frames;
+  unsigned long overruns;     // ticks skipped since the previous readout was still running
+  unsigned long lateShutters; // shutters skipped for the same reason
+  unsigned long maxJitterUs;
+  unsigned long sumJitterUs;
+};
+
+volatile ccdFrameTiming ccdTiming{};
+
+// the mean jitter in us
+float ccdFrameJitterAvgUs() {
+  return (ccdTiming.frames < 2) ? 0 : float(ccdTiming.sumJitterUs) / float(ccdTiming.frames - 1);
+}
+
+// read one frame out into the back frame, the readout also restarts the integration of the next.
+// if readoutStarted is set, ccdStartReadout has already been run (by the frame timer)
+void ccdCaptureIntoBack(bool readoutStarted = false) {
+  ccdFrame& frame     = ccdFrames[ccdBackFrame];
+  frame.explosureTime = ccdPipelineExplosureTime.load();
+  if (readoutStarted)
+    ccdFinishReadout(frame.linear);
+  else
+    ccdCaptureFrame(frame.linear);
+  frame.timestampMs = millis();
+  frame.seq         = ++ccdCapturedSeq;
+}
+
+#ifdef ARDUINO
+
+// the frame period and the integration are locked to hardware timers. the frame timer fires SI at
+// the frame period (ccd_frame_period_ms in args.h) and wakes the capture task, which clocks the
+// frame out. the shutter timer runs at the same period, the explosure time ahead of the frame
+// timer: it fires SI and clocks a whole readout out unread, the integration of the next frame
+// starts at its 18th clock. the interrupts only write the SI / CLK pins and the clock registers,
+// the rest is done by the task. the frame rate and the integration time are settings of their own
+// then, independent of how long the readout or anything else took
+const bool cCCDTimerLocked        = true;
+const uint8_t cCCDFrameTimer      = 0;
+const uint8_t cCCDShutterTimer    = 2;
+const uint16_t cCCDFrameTimerDiv  = 80;   // 80 MHz apb -> 1 us ticks, for both
+const int cCCDReadoutReserveUs    = 3000; // the readout is over before the shutter fires
+const int cCCDMinIntegrationUs    = 2000; // the shutter's own readout is over before the SI
+
+volatile unsigned long ccdFramePeriodUs = ccd_frame_period_ms * 1000UL;
+volatile unsigned long ccdIntegrationUs = 0; // the explosure time, cut to fit into the period
+volatile bool ccdReadoutPending         = false;
+unsigned long ccdLastIntegrationStartUs = 0; // owned by the capture task
+
+hw_timer_t* ccdFrameTimer          = NULL;
+hw_timer_t* ccdShutterTimer        = NULL;
+TaskHandle_t ccdCaptureTaskHandle  = NULL;
+TaskHandle_t ccdConsumerTaskHandle = NULL;
+
+// the shutter is moved to the explosure time before the frame timer: both count up to the period,
+// the shutter is set that much further on
+void ccdPlaceShutter() {
+  if (!ccdFrameTimer || !ccdShutterTimer)
+    return;
+  uint64_t frameCount = timerRead(ccdFrameTimer);
+  timerWrite(ccdShutterTimer, (frameCount + ccdIntegrationUs) % ccdFramePeriodUs);
+}
+
+void ccdPipelineSetExplosure(int explosureTimeMs) {
+  ccdPipelineExplosureTime = explosureTimeMs;
+
+  unsigned long integrationUs = (unsigned long)max(explosureTimeMs, 0) * 1000;
+  unsigned long longestUs     = ccdFramePeriodUs - cCCDReadoutReserveUs;
+  ccdIntegrationUs = max(min(integrationUs, longestUs), (unsigned long)cCCDMinIntegrationUs);
+  ccdPlaceShutter();
+}
+
+unsigned long ccdPipelineFramePeriodUs() { return ccdFramePeriodUs; }
+
+void IRAM_ATTR ccdFrameTimerISR() {
+  if (ccdReadoutPending) {
+    ccdTiming.overruns++;
+    return;
+  }
+
+  ccdStartReadout();
+  ccdReadoutPending = true;
+
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(ccdCaptureTaskHandle, &higherPriorityTaskWoken);
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+// a shutter during a readout would cut it short, the integration then runs from the readout's own
+// 18th clock instead
+void IRAM_ATTR ccdShutterTimerISR() {
+  if (ccdReadoutPending) {
+    ccdTiming.lateShutters++;
+    return;
+  }
+  ccdFireShutter();
+}
+
+// the period between the integration starts of the last two frames against the frame period
+void ccdMeasureJitter(unsigned long integrationStartUs) {
+  if (ccdLastIntegrationStartUs != 0) {
+    unsigned long periodUs = integrationStartUs - ccdLastIntegrationStartUs;
+    unsigned long jitterUs =
+        (periodUs > ccdFramePeriodUs) ? periodUs - ccdFramePeriodUs : ccdFramePeriodUs - periodUs;
+    ccdTiming.sumJitterUs += jitterUs;
+    if (jitterUs > ccdTiming.maxJitterUs)
+      ccdTiming.maxJitterUs = jitterUs;
+  }
+  ccdLastIntegrationStartUs = integrationStartUs;
+  ccdTiming.frames++;
+}
+
+// the capture task: read out, publish, then wait for the next frame to be integrated. with the
+// frame timer the wait is the timer period, otherwise the task just sleeps for the explosure time
+void ccdCaptureTask(void* pvParameters) {
+  for (;;) {
+    if (cCCDTimerLocked) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      ccdMeasureJitter(ccdReadoutIntegrationStartUs);
+      ccdCaptureIntoBack(true);
+      ccdReadoutPending = false;
+    } else {
+      ccdCaptureIntoBack();
+    }
+
+    ccdPublishFrame();
+    xTaskNotifyGive(ccdConsumerTaskHandle);
+
+    if (!cCCDTimerLocked)
+      vTaskDelay(pdMS_TO_TICKS(max(1, ccdPipelineExplosureTime.load())));
+  }
+}
+
+// start capturing in the background, must be called from the task that consumes the frames
+void ccdPipelineStart(int explosureTimeMs) {
+  if (ccdPipelineRunning)
+    return;
+
+  ccdPipelineSetExplosure(explosureTimeMs);
+  ccdConsumerTaskHandle = xTaskGetCurrentTaskHandle();
+  ccdPipelineRunning    = true;
+
+  xTaskCreatePinnedToCore(ccdCaptureTask, "CCDCapture", cCCDCaptureTaskStack, NULL,
+                          cCCDCaptureTaskPriority, &ccdCaptureTaskHandle, 0);
+
+  if (cCCDTimerLocked) {
+    ccdFrameTimer   = timerBegin(cCCDFrameTimer, cCCDFrameTimerDiv, true);
+    ccdShutterTimer = timerBegin(cCCDShutterTimer, cCCDFrameTimerDiv, true);
+    timerAttachInterrupt(ccdFrameTimer, &ccdFrameTimerISR, true);
+    timerAttachInterrupt(ccdShutterTimer, &ccdShutterTimerISR, true);
+    timerAlarmWrite(ccdFrameTimer, ccdFramePeriodUs, true);
+    timerAlarmWrite(ccdShutterTimer, ccdFramePeriodUs, true);
+    ccdPlaceShutter();
+    timerAlarmEnable(ccdShutterTimer);
+    timerAlarmEnable(ccdFrameTimer);
+  }
+}
+
+// block until a frame newer than the last consumed one is available and return it, if
+// waitFullExplosure is set, the frame that was already integrating is skipped as well, so the
+// returned frame has been integrated entirely after this call
+ccdFrame& ccdAcquireFrame(bool waitFullExplosure = false) {
+  unsigned long minSeq = waitFullExplosure ? ccdCapturedSeq.load() + 1 : 0;
+
+  for (;;) {
+    if (ccdTakeFrame() && ccdFrames[ccdFrontFrame].seq > minSeq)
+      return ccdFrames[ccdFrontFrame];
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(cCCDFrameWaitTimeoutMs));
+  }
+}
+
+#else
+
+void ccdPipelineSetExplosure(int explosureTimeMs) { ccdPipelineExplosureTime = explosureTimeMs; }
+
+// the host captures a frame whenever the tracking loop asks, the frame source sets the pace: the
+// simulator feeds one per explosure time
+unsigned long ccdPipelineFramePeriodUs() { return ccdPipelineExplosureTime * 1000UL; }
+
+// there is no capture task on the host, frames are produced on demand
+void ccdPipelineStart(int explosureTimeMs) {
+  ccdPipelineSetExplosure(explosureTimeMs);
+  ccdPipelineRunning = true;
+}
+
+ccdFrame& ccdAcquireFrame(bool /*waitFullExplosure*/ = false) {
+  ccdCaptureIntoBack();
+  ccdPublishFrame();
+  ccdTakeFrame();
+  return ccdFrames[ccdFrontFrame];
+}
+
+#endif
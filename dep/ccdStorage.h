@@ -0,0 +1,101 @@
+#pragma once
+
+#ifdef ARDUINO
+#include "../lib/arduino-esp32/libraries/Preferences/src/Preferences.h"
+#endif
+#include "ccd.h"
+#include "hal.h"
+
+// the ccd calibration is kept in nvs, so a warm boot only has to check the stored record with a
+// single frame instead of sweeping all explosure times again. the flat field correction table
+// (ccdFlatField.h) is kept here as well
+
+const char* cCCDStorageNamespace    = "ccd";
+const char* cCCDStorageRecordKey    = "record";
+const char* cCCDStorageTableKey     = "correction";
+const uint32_t cCCDStorageVersion   = 2;    // bump when the stored layout changes
+const float cCCDCalibrationDriftMax = 0.1f; // allowed contrast loss against the stored record
+
+struct storedCCDCalibration {
+  uint32_t version;
+  explosureRecord record; // avgVal is the parting threshold of the record
+};
+
+struct storedCCDCorrection {
+  uint32_t version;
+  ccdCorrectionTable table;
+};
+
+Preferences ccdPreferences;
+storedCCDCorrection storedCorrection; // too large for the task stacks
+
+bool loadCCDCalibration(explosureRecord& record) {
+  storedCCDCalibration stored;
+
+  ccdPreferences.begin(cCCDStorageNamespace, true);
+  size_t len = ccdPreferences.getBytes(cCCDStorageRecordKey, &stored, sizeof(stored));
+  ccdPreferences.end();
+
+  if (len != sizeof(stored) || stored.version != cCCDStorageVersion || !stored.record.isValid)
+    return false;
+
+  record = stored.record;
+  return true;
+}
+
+void saveCCDCalibration(const explosureRecord& record) {
+  storedCCDCalibration stored{cCCDStorageVersion, record};
+
+  ccdPreferences.begin(cCCDStorageNamespace, false);
+  ccdPreferences.putBytes(cCCDStorageRecordKey, &stored, sizeof(stored));
+  ccdPreferences.end();
+}
+
+// warm boot: take one frame with the stored explosure time, the stored record is only trusted if
+// the track is still found and the contrast has not drifted away
+bool warmStartCCD(explosureRecord& bestRecord, bool debug = false) {
+  explosureRecord storedRecord;
+  if (!loadCCDCalibration(storedRecord))
+    return false;
+
+  explosureRecord checkRecord;
+  measureExplosureRecord(checkRecord, storedRecord.explosureTime, debug);
+
+  if (debug) {
+    Serial.print("stored explosure time: ");
+    Serial.print(storedRecord.explosureTime);
+    Serial.print("  contrast: ");
+    Serial.print(storedRecord.contrast);
+    Serial.print(" -> ");
+    Serial.println(checkRecord.contrast);
+  }
+
+  bool drifted = checkRecord.contrast > storedRecord.contrast + cCCDCalibrationDriftMax;
+  if (!checkRecord.isValid || drifted)
+    return false;
+
+  bestRecord = checkRecord;
+  return true;
+}
+
+bool loadCCDCorrection(ccdCorrectionTable& table) {
+  ccdPreferences.begin(cCCDStorageNamespace, true);
+  size_t len = ccdPreferences.getBytes(cCCDStorageTableKey, &storedCorrection,
+                                       sizeof(storedCorrection));
+  ccdPreferences.end();
+
+  if (len != sizeof(storedCorrection) || storedCorrection.version != cCCDStorageVersion)
+    return false;
+
+  table = storedCorrection.table;
+  return true;
+}
+
+void saveCCDCorrection(const ccdCorrectionTable& table) {
+  storedCorrection.version = cCCDStorageVersion;
+  storedCorrection.table   = table;
+
+  ccdPreferences.begin(cCCDStorageNamespace, false);
+  ccdPreferences.putBytes(cCCDStorageTableKey, &storedCorrection, sizeof(storedCorrection));
+  ccdPreferences.end();
+}
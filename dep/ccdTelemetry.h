@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ccdTelemetryFormat.h"
+#include "channel.h"
+#include "hal.h"
+
+// binary ccd telemetry: the tracking loop copies every processed frame into a record of a
+// single-producer single-consumer ring (channel.h), and a background task on core 0 drains the
+// ring to a stream (serial or bluetooth). pushing a record is a 148 byte copy and never blocks,
+// when the link cannot keep up the record is dropped and counted instead of stalling the tracking
+// loop
+
+const int cCCDTelemetrySlots        = 8; // power of two
+const int cCCDTelemetryTaskStack    = 2048;
+const int cCCDTelemetryTaskPriority = 1;
+const int cCCDTelemetryIdleMs       = 5;
+
+spscRing<ccdTelemetryRecord, cCCDTelemetrySlots> ccdTelemetryRing;
+
+bool ccdTelemetryRunning        = false;
+unsigned long ccdTelemetryDrops = 0;
+unsigned long ccdTelemetrySent  = 0;
+Stream* ccdTelemetryOut         = NULL;
+
+// producer side, called from the tracking loop
+void ccdTelemetryPush(uint8_t status, uint32_t seq, uint32_t timestampMs, int explosureTime,
+                      int threshold, int centreQ8, uint8_t flags, const uint8_t* samples) {
+  if (!ccdTelemetryRunning)
+    return;
+
+  // the record is filled in place in its slot
+  ccdTelemetryRecord* slot = ccdTelemetryRing.claim();
+  if (!slot) {
+    ccdTelemetryDrops++;
+    return;
+  }
+
+  ccdTelemetryRecord& record = *slot;
+  record.sync                = cCCDTelemetrySync;
+  record.version             = cCCDTelemetryVersion;
+  record.status              = status;
+  record.seq                 = seq;
+  record.timestampMs         = timestampMs;
+  record.explosureTime       = explosureTime;
+  record.threshold           = threshold;
+  record.flags               = flags;
+  record.centreQ8            = centreQ8;
+  memcpy(record.samples, samples, cCCDTelemetrySamples);
+  ccdTelemetrySeal(record);
+
+  ccdTelemetryRing.commit();
+}
+
+// consumer side, returns false when the ring is empty
+bool ccdTelemetrySendOne() {
+  const ccdTelemetryRecord* record = ccdTelemetryRing.peek();
+  if (!record)
+    return false;
+
+  ccdTelemetryOut->write((const uint8_t*)record, sizeof(ccdTelemetryRecord));
+  ccdTelemetrySent++;
+
+  ccdTelemetryRing.release();
+  return true;
+}
+
+void ccdTelemetryTask(void* /*pvParameters*/) {
+  for (;;) {
+    while (ccdTelemetrySendOne()) {
+    }
+    delay(cCCDTelemetryIdleMs);
+  }
+}
+
+// start streaming the records to out, the debug text printed to the same stream is skipped by the
+// decoder, which resyncs on the sync word and checksum
+void ccdTelemetryStart(Stream& out) {
+  if (ccdTelemetryRunning)
+    return;
+
+  ccdTelemetryOut     = &out;
+  ccdTelemetryRunning = true;
+  xTaskCreatePinnedToCore(ccdTelemetryTask, "CCDTelemetry", cCCDTelemetryTaskStack, NULL,
+                          cCCDTelemetryTaskPriority, NULL, 0);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+// the binary ccd telemetry record, one per processed frame. the layout is shared by the car and the
+// host decoder (host/ccdTelemetryDecode.cpp), so this header must only depend on stdint. all fields
+// are little endian, which both the esp32 and x86 hosts are
+
+const uint16_t cCCDTelemetrySync    = 0xA55A;
+const uint8_t cCCDTelemetryVersion  = 1;
+const int cCCDTelemetrySamples      = 128;
+const uint8_t cCCDTelemetryApproach = 0x1; // flags: the platform detector is approaching
+
+struct __attribute__((packed)) ccdTelemetryRecord {
+  uint16_t sync;
+  uint8_t version;
+  uint8_t status; // STATUS_* of ccd.h
+  uint32_t seq;   // frame sequence number of the capture pipeline, gaps mean dropped records
+  uint32_t timestampMs;
+  uint16_t explosureTime;
+  uint8_t threshold;
+  uint8_t flags;
+  int16_t centreQ8; // track centre in raw pixels, Q8, -1 when there is none
+  uint8_t samples[cCCDTelemetrySamples];
+  uint16_t checksum; // fletcher-16 over everything above
+};
+
+// fletcher-16, cheap enough to run per record on the car and catches the byte slips and
+// interleaved text a shared serial line produces
+inline uint16_t ccdTelemetryChecksum(const uint8_t* data, int len) {
+  uint16_t sum1 = 0, sum2 = 0;
+  for (int i = 0; i < len; i++) {
+    sum1 = (sum1 + data[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  return (sum2 << 8) | sum1;
+}
+
+inline void ccdTelemetrySeal(ccdTelemetryRecord& record) {
+  record.checksum = ccdTelemetryChecksum((const uint8_t*)&record,
+                                         sizeof(ccdTelemetryRecord) - sizeof(record.checksum));
+}
+
+inline bool ccdTelemetryValid(const ccdTelemetryRecord& record) {
+  return record.sync == cCCDTelemetrySync && record.version == cCCDTelemetryVersion &&
+         record.checksum ==
+             ccdTelemetryChecksum((const uint8_t*)&record,
+                                  sizeof(ccdTelemetryRecord) - sizeof(record.checksum));
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+#include "hal.h"
+
+// lock-free channels between interrupts and tasks. neither side ever waits on the other or takes a
+// lock, so both are safe in an interrupt handler: every member is IRAM_ATTR, and a channel keeps
+// its data in itself, i.e. in ram when it is a global. they build on the host hal unchanged
+//
+//  - spscRing: a queue of values from a single producer to a single consumer, nothing is lost or
+//    reordered, a push into a full ring fails
+//  - seqlockCell: the latest value of a single writer, for any number of readers. the writer never
+//    waits, a reader retries while a write is under way
+//
+// the mailbox (mailbox.h) is the third kind, the latest value of a single writer for a single
+// reader, with neither side retrying
+
+#ifdef ARDUINO
+const size_t cChannelLine = 4; // the esp32 has no data cache in front of its internal ram
+#else
+const size_t cChannelLine = 64; // the two sides of a channel on different cache lines
+#endif
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the channels need lock-free 32 bit atomics");
+
+/// @brief a wait-free single producer single consumer ring of N values, N a power of two. the
+/// producer and the consumer may be any two of the interrupts and tasks, on either core. a value is
+/// either pushed and popped as a copy, or written and read in place in its slot: claim() and
+/// commit() on the producer side, peek() and release() on the consumer side
+template <class T, uint32_t N> class spscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "the size of a ring is a power of two");
+
+public:
+  // producer side: the free slot to write the next value into, NULL when the ring is full
+  T* IRAM_ATTR claim() {
+    uint32_t at = head.load(std::memory_order_relaxed);
+    if (at - tailSeen >= N) {
+      tailSeen = tail.load(std::memory_order_acquire);
+      if (at - tailSeen >= N)
+        return NULL;
+    }
+    return &slots[at & (N - 1)];
+  }
+
+  // producer side: hand the claimed slot to the consumer
+  void IRAM_ATTR commit() {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // producer side, returns false when the ring is full
+  bool IRAM_ATTR push(const T& value) {
+    T* slot = claim();
+    if (!slot)
+      return false;
+    *slot = value;
+    commit();
+    return true;
+  }
+
+  // consumer side: the oldest value, NULL when the ring is empty
+  T* IRAM_ATTR peek() {
+    uint32_t at = tail.load(std::memory_order_relaxed);
+    if (at == headSeen) {
+      headSeen = head.load(std::memory_order_acquire);
+      if (at == headSeen)
+        return NULL;
+    }
+    return &slots[at & (N - 1)];
+  }
+
+  // consumer side: hand the peeked slot back to the producer
+  void IRAM_ATTR release() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // consumer side, returns false when the ring is empty
+  bool IRAM_ATTR pop(T& value) {
+    T* slot = peek();
+    if (!slot)
+      return false;
+    value = *slot;
+    release();
+    return true;
+  }
+
+  // consumer side: drop everything pushed so far
+  void IRAM_ATTR clear() {
+    headSeen = head.load(std::memory_order_acquire);
+    tail.store(headSeen, std::memory_order_release);
+  }
+
+  // the number of values in the ring, exact on either side as far as that side is concerned: the
+  // other one can only make it smaller (consumer) or larger (producer) in the meantime
+  uint32_t IRAM_ATTR size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  bool IRAM_ATTR empty() const { return size() == 0; }
+
+  static constexpr uint32_t capacity() { return N; }
+
+private:
+  T slots[N]{};
+
+  // the indices run freely and wrap around, a slot is the index modulo N. each side caches the
+  // index of the other, it only loads it again when the ring looks full or empty
+  alignas(cChannelLine) std::atomic<uint32_t> head{0}; // written by the producer only
+  uint32_t tailSeen = 0;                               // owned by the producer
+  alignas(cChannelLine) std::atomic<uint32_t> tail{0}; // written by the consumer only
+  uint32_t headSeen = 0;                               // owned by the consumer
+};
+
+/// @brief a value of a single writer, read by any number of readers as a whole. the sequence
+/// counter is odd while a write is under way and counts up by two with every write: a reader copies
+/// the value out and retries when the counter was odd or changed meanwhile. the value is held as
+/// 32 bit atomic words, so a torn copy is never a data race, only a retry. T must be trivially
+/// copyable. a reader must not preempt the writer on its core, it would retry for ever: readers in
+/// an interrupt use tryRead() instead of read()
+template <class T> class seqlockCell {
+  static_assert(std::is_trivially_copyable<T>::value, "a seqlock cell holds a plain value");
+
+public:
+  // writer side
+  void IRAM_ATTR write(const T& value) {
+    uint32_t words[cWords] = {};
+    memcpy(words, &value, sizeof(T));
+
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint32_t i = 0; i < cWords; i++)
+      data[i].store(words[i], std::memory_order_relaxed);
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+  // reader side, a single attempt: returns false when it overlapped a write
+  bool IRAM_ATTR tryRead(T& value) const {
+    uint32_t s = seq.load(std::memory_order_acquire);
+    if (s & 1)
+      return false;
+
+    uint32_t words[cWords];
+    for (uint32_t i = 0; i < cWords; i++)
+      words[i] = data[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq.load(std::memory_order_relaxed) != s)
+      return false;
+
+    memcpy(&value, words, sizeof(T));
+    return true;
+  }
+
+  // reader side, retries until it gets a whole value
+  T IRAM_ATTR read() const {
+    T value;
+    while (!tryRead(value)) {
+    }
+    return value;
+  }
+
+  // the number of writes so far, a reader can tell a new value from the one it read before
+  uint32_t IRAM_ATTR writes() const { return seq.load(std::memory_order_acquire) / 2; }
+
+private:
+  static const uint32_t cWords = (sizeof(T) + 3) / 4;
+
+  std::atomic<uint32_t> seq{0};
+  std::atomic<uint32_t> data[cWords]{};
+};
@@ -1,10 +1,14 @@
 #pragma once
 
+#ifdef ARDUINO
 #include "../lib/arduino-esp32/libraries/Wire/src/Wire.h"
+#endif
 #include "boardLed.h"
+#include "hal.h"
 #include "math.h"
 #include "oled.h"
 #include "pinouts.h"
+#include "sensorLog.h"
 
 const int COLOR_RED    = 0;
 const int COLOR_GREEN  = 1;
@@ -97,6 +101,7 @@ void getColor() {
     rgb[i] = (*(rawBuff + i * 2) << 8) & 0xff00;
     rgb[i] |= *(rawBuff + i * 2 + 1);
   }
+  sensorLogColorRead(rgb);
 }
 
 // the function to request for the buffer read from the color sensor, given the device address and
@@ -115,7 +120,7 @@ bool requestBuffer(uint8_t deviceAddr, uint8_t bufferAddr, uint8_t* buffer, uint
 }
 
 // get the rgb value
-int getRGB(bool relativeVal) {
+int getRGB(bool /*relativeVal*/) {
   getColor();
 
   for (int i = 0; i < 3; i++) {
@@ -161,4 +166,5 @@ int parseColor() {
   case 2:
     return COLOR_BLUE;
   }
+  return COLOR_EMPTY;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "allCommands.h"
+#include "hal.h"
 #include "math.h"
 #include "motor.h"
 #include "servo.h"
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "channel.h"
+#include "hal.h"
+
+// the control loop runs at a fixed rate, released by a hardware timer. the timer interrupt wakes
+// the control task, which has the highest priority on core 1, so a step starts within a few us of
+// its tick whatever the tracking loop is doing, and the control period no longer depends on how
+// long the capture, the ccd processing or the display take. on the host the step runs in the timer
+// interrupt itself, which the simulated hal fires at the exact tick of the virtual clock
+//
+// every step is timed: the period since the start of the previous step goes to a histogram, a
+// step that ends after the next tick was due is a deadline miss, and a tick that finds the previous
+// step still running is skipped and counted as an overrun. the other tasks read the timing and the
+// histogram from snapshots the control task publishes after every step
+
+const uint8_t cControlTimer     = 1;  // timers 0 and 2 are the ccd frame and shutter timers
+const uint16_t cControlTimerDiv = 80; // 80 MHz apb -> 1 us ticks
+const int cControlTaskStack     = 4096;
+const int cControlTaskPriority  = 5; // above the ccd capture task and Task2
+const int cPeriodHistogramBins  = 16;
+
+/// @brief a histogram of the periods of a periodic loop, the bins cover 0 to twice the nominal
+/// period and the last one also takes everything longer. it belongs to the loop that marks it,
+/// other tasks print a copy published through a seqlockCell
+class periodHistogram {
+public:
+  void setNominal(unsigned long periodUs) {
+    nominalUs = (periodUs > 0) ? periodUs : 1;
+    reset();
+  }
+
+  void reset() {
+    for (int i = 0; i < cPeriodHistogramBins; i++)
+      bins[i] = 0;
+    count = sumUs = maxUs = lastPeriodUs = 0;
+    minUs   = (unsigned long)-1;
+    started = false;
+  }
+
+  // an iteration of the loop starts at nowUs
+  void mark(unsigned long nowUs) {
+    if (started)
+      add(nowUs - lastUs);
+    lastUs  = nowUs;
+    started = true;
+  }
+
+  void add(unsigned long periodUs) {
+    unsigned long bin = periodUs * cPeriodHistogramBins / (2 * nominalUs);
+    bins[(bin < cPeriodHistogramBins) ? bin : cPeriodHistogramBins - 1]++;
+    count++;
+    sumUs += periodUs;
+    lastPeriodUs = periodUs;
+    if (periodUs > maxUs)
+      maxUs = periodUs;
+    if (periodUs < minUs)
+      minUs = periodUs;
+  }
+
+  float meanUs() const { return (count == 0) ? 0 : float(sumUs) / float(count); }
+
+  void print(Stream& out, const char* name) const {
+    out.printf("%s: %lu periods, nominal %lu us, mean %.1f us, min %lu us, max %lu us\n", name,
+               count, nominalUs, meanUs(), (count == 0) ? 0 : minUs, maxUs);
+    for (int i = 0; i < cPeriodHistogramBins; i++) {
+      if (bins[i] == 0)
+        continue;
+      unsigned long from = 2 * nominalUs * i / cPeriodHistogramBins;
+      if (i == cPeriodHistogramBins - 1)
+        out.printf("  %6lu us -        : %lu\n", from, bins[i]);
+      else
+        out.printf("  %6lu us - %6lu : %lu\n", from, 2 * nominalUs * (i + 1) / cPeriodHistogramBins,
+                   bins[i]);
+    }
+  }
+
+  unsigned long bins[cPeriodHistogramBins]{};
+  unsigned long count = 0, sumUs = 0, minUs = 0, maxUs = 0, lastPeriodUs = 0;
+  unsigned long nominalUs = 1;
+
+private:
+  unsigned long lastUs = 0;
+  bool started         = false;
+};
+
+// timing statistics of the control steps
+struct controlStepTiming {
+  unsigned long steps;
+  unsigned long overruns;       // ticks skipped since the previous step was still running
+  unsigned long deadlineMisses; // steps that ended after the next tick was due
+  unsigned long maxLatencyUs;   // from the tick to the start of the step
+  unsigned long maxExecUs;
+  unsigned long sumExecUs;
+};
+
+// a control step, dt is the time in s since the start of the previous step as measured, the nominal
+// control period for the first one
+typedef void (*controlStepFunction)(float dt);
+
+controlStepTiming controlTiming{};                    // owned by the control task
+std::atomic<unsigned long> controlOverruns{0};        // counted by the timer interrupt
+seqlockCell<controlStepTiming> controlTimingSnapshot; // controlTiming, for the other tasks
+periodHistogram controlPeriods;                       // owned by the control task
+seqlockCell<periodHistogram> controlPeriodsSnapshot;  // controlPeriods, for the other tasks
+
+controlStepFunction controlStep      = NULL;
+unsigned long controlPeriodUs        = 0;
+float controlPeriodS                 = 0;
+bool controlSchedulerRunning         = false;
+volatile unsigned long controlTickUs = 0;
+volatile bool controlStepPending     = false;
+
+hw_timer_t* controlTimer       = NULL;
+TaskHandle_t controlTaskHandle = NULL;
+
+// the mean execution time of a step in us
+float controlExecAvgUs(const controlStepTiming& timing) {
+  return (timing.steps == 0) ? 0 : float(timing.sumExecUs) / float(timing.steps);
+}
+
+// run a step and time it
+void controlRunStep() {
+  unsigned long startUs = micros();
+  controlPeriods.mark(startUs);
+  controlStep((controlPeriods.count == 0) ? controlPeriodS : controlPeriods.lastPeriodUs * 1e-6f);
+  unsigned long endUs = micros();
+
+  unsigned long execUs    = endUs - startUs;
+  unsigned long latencyUs = startUs - controlTickUs;
+  controlTiming.steps++;
+  controlTiming.sumExecUs += execUs;
+  if (execUs > controlTiming.maxExecUs)
+    controlTiming.maxExecUs = execUs;
+  if (latencyUs > controlTiming.maxLatencyUs)
+    controlTiming.maxLatencyUs = latencyUs;
+  if (endUs - controlTickUs > controlPeriodUs)
+    controlTiming.deadlineMisses++;
+  controlTiming.overruns = controlOverruns.load(std::memory_order_relaxed);
+  controlTimingSnapshot.write(controlTiming);
+  controlPeriodsSnapshot.write(controlPeriods);
+
+  controlStepPending = false;
+}
+
+void IRAM_ATTR controlTimerISR() {
+  if (controlStepPending) {
+    controlOverruns.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  controlTickUs      = micros();
+  controlStepPending = true;
+
+#ifdef ARDUINO
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(controlTaskHandle, &higherPriorityTaskWoken);
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+#else
+  controlRunStep();
+#endif
+}
+
+void controlTask(void* /*pvParameters*/) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    controlRunStep();
+  }
+}
+
+// run step at rateHz from now on
+void controlSchedulerStart(int rateHz, controlStepFunction step) {
+  if (controlSchedulerRunning)
+    return;
+
+  controlStep     = step;
+  controlPeriodUs = 1000000UL / rateHz;
+  controlPeriodS  = 1.0f / rateHz;
+  controlPeriods.setNominal(controlPeriodUs);
+  controlSchedulerRunning = true;
+
+#ifdef ARDUINO
+  xTaskCreatePinnedToCore(controlTask, "Control", cControlTaskStack, NULL, cControlTaskPriority,
+                          &controlTaskHandle, 1);
+#endif
+
+  controlTimer = timerBegin(cControlTimer, cControlTimerDiv, true);
+  timerAttachInterrupt(controlTimer, &controlTimerISR, true);
+  timerAlarmWrite(controlTimer, controlPeriodUs, true);
+  timerAlarmEnable(controlTimer);
+}
+
+void controlSchedulerPrint(Stream& out) {
+  controlStepTiming timing = controlTimingSnapshot.read();
+  out.printf("control: %lu steps, %lu deadline misses, %lu overruns, exec %.1f us mean %lu us max, "
+             "latency %lu us max\n",
+             timing.steps, timing.deadlineMisses, timing.overruns, controlExecAvgUs(timing),
+             timing.maxExecUs, timing.maxLatencyUs);
+  controlPeriodsSnapshot.read().print(out, "control period");
+}
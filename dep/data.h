@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../args.h"
+#include "hal.h"
 
 typedef struct {
   int count;
@@ -0,0 +1,21 @@
+#pragma once
+
+// the hardware abstraction of the firmware. the interface is the subset of the arduino-esp32 core
+// the car uses: gpio (pinMode, digitalRead / Write, attachInterrupt), adc (analogRead), ledc pwm
+// (ledcSetup / AttachPin / Write), i2c (TwoWire), clock (millis, micros, delay), serial (Serial,
+// BluetoothSerial), the oled, nvs (Preferences) and the few freertos calls for tasks and
+// notifications. there are two backends:
+//
+//  - esp32: the arduino core itself, plus the vendored libraries under lib/
+//  - linux: halLinux.h, a simulation of the same calls, so the firmware compiles unchanged into a
+//    host executable. inputs (pins, adc, i2c devices) are injected and outputs (pins, pwm duties,
+//    oled text) inspected through its hal* functions
+//
+// every header of dep/ that touches the hardware includes this one, and the esp32 only code paths
+// are guarded by ARDUINO
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include "halLinux.h"
+#endif
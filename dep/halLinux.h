@@ -0,0 +1,757 @@
+#pragma once
+
+// the linux backend of hal.h. everything the firmware calls on the esp32 is simulated here with
+// plain state: pins and pwm duties are arrays, adc pins are read from sources set by the host, i2c
+// transfers go to registered device models, serial goes to stdout, tasks are threads, and hardware
+// timers fire on the clock they were enabled on. the clock is the wall clock by default, with
+// halClockSimulated(true) delay() only advances a virtual clock instead, which lets replays and
+// simulations run faster than real time and reproducibly. only the thread that switched the
+// virtual clock on drives it, the delays of background tasks (e.g. the telemetry sender) still
+// sleep on the wall clock
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the esp32 arduino core defines these as macros as well, the firmware relies on mixed types
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define IRAM_ATTR
+#define digitalPinToInterrupt(p) (p)
+
+const int cHalPins         = 40;
+const int cHalLedcChannels = 16;
+
+// clock
+
+std::atomic<bool> halSimulatedClock{false};
+std::atomic<uint64_t> halSimulatedUs{0};
+std::thread::id halClockOwner;
+
+inline uint64_t halWallUs() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                               start)
+      .count();
+}
+
+// switch between the wall clock and the virtual clock, the virtual clock continues from the time
+// the wall clock shows at the switch
+inline void halClockSimulated(bool simulated) {
+  if (simulated && !halSimulatedClock)
+    halSimulatedUs = halWallUs();
+  halClockOwner     = std::this_thread::get_id();
+  halSimulatedClock = simulated;
+}
+
+// switch to the virtual clock, starting at `us`, for runs that have to be reproducible
+inline void halClockSimulatedFrom(uint64_t us) {
+  halSimulatedUs    = us;
+  halClockOwner     = std::this_thread::get_id();
+  halSimulatedClock = true;
+}
+
+// called before the virtual clock moves to a new time, a simulation steps its models of the outside
+// world up to that time with it, so they keep moving while the firmware waits in delay()
+std::function<void(uint64_t)> halClockHook;
+
+// hardware timers, counting at 80 MHz / divider. a timer enabled on the virtual clock is fired by
+// the thread that drives the clock: the clock stops at every alarm on its way to a new time and the
+// interrupt runs right there, in that thread. a timer enabled on the wall clock has a thread of its
+// own that sleeps until the next alarm
+
+const int cHalTimers = 4;
+
+struct hw_timer_t {
+  uint16_t divider = 80;
+  void (*isr)()    = nullptr;
+  uint64_t alarm   = 0; // ticks
+  bool autoreload  = false;
+  bool simulated   = false;
+  uint64_t nextUs  = 0; // the next alarm on the virtual clock
+  std::atomic<bool> enabled{false};
+  std::atomic<uint32_t> generation{0}; // bumped on every enable, stops the thread of the last one
+};
+
+hw_timer_t halTimers[cHalTimers];
+
+inline uint64_t halTimerPeriodUs(const hw_timer_t& timer) {
+  return max(timer.alarm * timer.divider / 80, uint64_t(1));
+}
+
+// the enabled timer of the virtual clock with the earliest alarm up to `us`, if there is one
+inline hw_timer_t* halNextAlarm(uint64_t us) {
+  hw_timer_t* next = nullptr;
+  for (hw_timer_t& timer : halTimers) {
+    if (!timer.enabled || !timer.simulated || timer.nextUs > us)
+      continue;
+    if (!next || timer.nextUs < next->nextUs)
+      next = &timer;
+  }
+  return next;
+}
+
+// move the virtual clock to `us`, through all the alarms on the way
+inline void halMoveClockTo(uint64_t us) {
+  for (;;) {
+    hw_timer_t* timer = halNextAlarm(us);
+    uint64_t to       = timer ? timer->nextUs : us;
+    if (halClockHook && to > halSimulatedUs)
+      halClockHook(to);
+    halSimulatedUs = max(to, halSimulatedUs.load());
+    if (!timer)
+      return;
+
+    if (timer->autoreload)
+      timer->nextUs += halTimerPeriodUs(*timer);
+    else
+      timer->enabled = false;
+    timer->isr();
+  }
+}
+
+// move the virtual clock forward, has no effect on the wall clock
+inline void halAdvanceUs(uint64_t us) { halMoveClockTo(halSimulatedUs + us); }
+
+// move the virtual clock to `us`, it never goes backwards
+inline void halAdvanceToUs(uint64_t us) {
+  if (us > halSimulatedUs)
+    halMoveClockTo(us);
+}
+
+inline unsigned long micros() {
+  return (unsigned long)(halSimulatedClock ? halSimulatedUs.load() : halWallUs());
+}
+inline unsigned long millis() { return micros() / 1000; }
+
+inline void delayMicroseconds(uint32_t us) {
+  if (halSimulatedClock && std::this_thread::get_id() == halClockOwner)
+    halAdvanceUs(us);
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+inline void delay(uint32_t ms) { delayMicroseconds(ms * 1000); }
+
+inline void halTimerThread(hw_timer_t* timer, uint32_t generation) {
+  auto next = std::chrono::steady_clock::now();
+  for (;;) {
+    next += std::chrono::microseconds(halTimerPeriodUs(*timer));
+    std::this_thread::sleep_until(next);
+    if (!timer->enabled || timer->generation != generation)
+      return;
+    if (!timer->autoreload)
+      timer->enabled = false;
+    timer->isr();
+  }
+}
+
+inline hw_timer_t* timerBegin(uint8_t num, uint16_t divider, bool /*countUp*/) {
+  if (num >= cHalTimers)
+    return nullptr;
+  halTimers[num].divider = divider;
+  return &halTimers[num];
+}
+
+inline void timerAttachInterrupt(hw_timer_t* timer, void (*fn)(), bool /*edge*/) {
+  timer->isr = fn;
+}
+
+// a new alarm of an enabled timer counts from its next alarm on
+inline void timerAlarmWrite(hw_timer_t* timer, uint64_t alarm, bool autoreload) {
+  timer->alarm      = alarm;
+  timer->autoreload = autoreload;
+}
+
+inline void timerAlarmEnable(hw_timer_t* timer) {
+  if (timer->enabled)
+    return;
+  uint32_t generation = ++timer->generation;
+  timer->simulated    = halSimulatedClock;
+  timer->nextUs       = micros() + halTimerPeriodUs(*timer);
+  timer->enabled      = true;
+  if (!timer->simulated)
+    std::thread(halTimerThread, timer, generation).detach();
+}
+
+inline void timerAlarmDisable(hw_timer_t* timer) { timer->enabled = false; }
+inline void timerEnd(hw_timer_t* timer) { timer->enabled = false; }
+
+// move the next alarm of a timer on the virtual clock to `us`, e.g. to put its ticks in the phase
+// they had in a recorded run
+inline void halTimerAlarmAt(hw_timer_t* timer, uint64_t us) { timer->nextUs = us; }
+
+// gpio
+
+struct halPinState {
+  uint8_t mode;
+  uint8_t level;
+  void (*isr)();
+  int isrMode;
+};
+
+halPinState halPins[cHalPins]{};
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= cHalPins)
+    return;
+  halPins[pin].mode = mode;
+  if (mode == INPUT_PULLUP)
+    halPins[pin].level = HIGH;
+}
+
+inline int digitalRead(uint8_t pin) { return (pin < cHalPins) ? halPins[pin].level : LOW; }
+
+inline void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin < cHalPins)
+    halPins[pin].level = val ? HIGH : LOW;
+}
+
+inline void attachInterrupt(uint8_t pin, void (*isr)(), int mode) {
+  if (pin >= cHalPins)
+    return;
+  halPins[pin].isr     = isr;
+  halPins[pin].isrMode = mode;
+}
+
+inline void detachInterrupt(uint8_t pin) {
+  if (pin < cHalPins)
+    halPins[pin].isr = nullptr;
+}
+
+// drive an input pin from the outside world, the attached interrupt fires on a matching edge
+inline void halSetPin(uint8_t pin, uint8_t level) {
+  if (pin >= cHalPins)
+    return;
+  halPinState& p = halPins[pin];
+  uint8_t prev   = p.level;
+  p.level        = level ? HIGH : LOW;
+  if (!p.isr || prev == p.level)
+    return;
+  bool rising = p.level == HIGH;
+  if (p.isrMode == CHANGE || (p.isrMode == RISING && rising) || (p.isrMode == FALLING && !rising))
+    p.isr();
+}
+
+// adc
+
+int halAdcBits = 12;
+std::function<int(uint8_t)> halAnalogSource[cHalPins];
+int halAnalogValue[cHalPins]{};
+
+inline void analogReadResolution(uint8_t bits) { halAdcBits = bits; }
+
+// the values set / produced for an adc pin are full scale 12-bit, as on the esp32, they are scaled
+// to the configured resolution on read
+inline void halSetAnalog(uint8_t pin, int val12) {
+  if (pin < cHalPins)
+    halAnalogValue[pin] = val12;
+}
+inline void halSetAnalogSource(uint8_t pin, std::function<int(uint8_t)> source) {
+  if (pin < cHalPins)
+    halAnalogSource[pin] = source;
+}
+
+inline uint16_t analogRead(uint8_t pin) {
+  if (pin >= cHalPins)
+    return 0;
+  int val = halAnalogSource[pin] ? halAnalogSource[pin](pin) : halAnalogValue[pin];
+  val     = (val < 0) ? 0 : (val > 4095 ? 4095 : val);
+  return (halAdcBits >= 12) ? val << (halAdcBits - 12) : val >> (12 - halAdcBits);
+}
+
+// ledc
+
+struct halLedcChannel {
+  double freq;
+  uint8_t bits;
+  uint32_t duty;
+  int pin;
+};
+
+halLedcChannel halLedc[cHalLedcChannels]{};
+
+inline double ledcSetup(uint8_t channel, double freq, uint8_t bits) {
+  if (channel >= cHalLedcChannels)
+    return 0;
+  halLedc[channel].freq = freq;
+  halLedc[channel].bits = bits;
+  return freq;
+}
+
+inline void ledcAttachPin(uint8_t pin, uint8_t channel) {
+  if (channel < cHalLedcChannels)
+    halLedc[channel].pin = pin;
+}
+
+inline void ledcDetachPin(uint8_t pin) {
+  for (int c = 0; c < cHalLedcChannels; c++)
+    if (halLedc[c].pin == pin)
+      halLedc[c].pin = -1;
+}
+
+inline void ledcWrite(uint8_t channel, uint32_t duty) {
+  if (channel < cHalLedcChannels)
+    halLedc[channel].duty = duty;
+}
+
+inline uint32_t ledcRead(uint8_t channel) {
+  return (channel < cHalLedcChannels) ? halLedc[channel].duty : 0;
+}
+
+// the duty of a channel in [0, 1]
+inline float halLedcDutyRatio(uint8_t channel) {
+  if (channel >= cHalLedcChannels || halLedc[channel].bits == 0)
+    return 0;
+  return float(halLedc[channel].duty) / float((1u << halLedc[channel].bits) - 1);
+}
+
+// misc
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+// serial
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++)
+      write(buffer[i]);
+    return size;
+  }
+
+  size_t print(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+  size_t print(const std::string& str) { return print(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int val, int base = 10) { return print(long(val), base); }
+  size_t print(unsigned int val, int base = 10) { return print((unsigned long)val, base); }
+  size_t print(long val, int base = 10) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == 16 ? "%lx" : "%ld", val);
+    return print(buf);
+  }
+  size_t print(unsigned long val, int base = 10) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == 16 ? "%lx" : "%lu", val);
+    return print(buf);
+  }
+  size_t print(double val, int digits = 2) {
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%.*f", digits, val);
+    return print(buf);
+  }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    return (len < 0) ? 0 : write((const uint8_t*)buf, min(size_t(len), sizeof(buf) - 1));
+  }
+
+  size_t println() { return print("\r\n"); }
+  template <class T> size_t println(T val) { return print(val) + println(); }
+  template <class T> size_t println(T val, int format) { return print(val, format) + println(); }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+
+  size_t readBytes(uint8_t* buffer, size_t length) {
+    size_t n = 0;
+    while (n < length && available() > 0)
+      buffer[n++] = read();
+    return n;
+  }
+};
+
+// a serial port that writes to a file (stdout for Serial), input is fed with halSerialFeed
+class HardwareSerial : public Stream {
+public:
+  HardwareSerial(FILE* out) : output(out) {}
+
+  void begin(unsigned long /*baud*/) {}
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (output) {
+      fwrite(buffer, 1, size, output);
+      fflush(output);
+    }
+    return size;
+  }
+
+  int available() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    return int(input.size() - inputPos);
+  }
+  int read() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (inputPos < input.size()) ? input[inputPos++] : -1;
+  }
+
+  void feed(const uint8_t* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    input.insert(input.end(), data, data + size);
+  }
+  void setOutput(FILE* out) { output = out; }
+
+private:
+  FILE* output;
+  std::mutex mutex;
+  std::vector<uint8_t> input;
+  size_t inputPos = 0;
+};
+
+HardwareSerial Serial(stdout);
+
+// bluetooth serial, the output is discarded unless a file is set with setOutput
+class BluetoothSerial : public HardwareSerial {
+public:
+  BluetoothSerial() : HardwareSerial(nullptr) {}
+  bool begin(const char* /*name*/) {
+    started = true;
+    return true;
+  }
+  bool connected() { return started; }
+
+private:
+  bool started = false;
+};
+
+// i2c
+
+// a device model on the simulated i2c bus
+class halI2cDevice {
+public:
+  virtual ~halI2cDevice() {}
+  virtual void onWrite(const uint8_t* data, int len) = 0;
+  virtual int onRead(uint8_t* data, int len)         = 0;
+};
+
+std::map<uint8_t, halI2cDevice*> halI2cDevices;
+
+inline void halAttachI2cDevice(uint8_t addr, halI2cDevice* device) {
+  halI2cDevices[addr] = device;
+}
+
+class TwoWire : public Stream {
+public:
+  bool begin() { return true; }
+  bool begin(int /*sda*/, int /*scl*/, uint32_t /*freq*/ = 0) { return true; }
+
+  void beginTransmission(uint8_t addr) {
+    txAddr = addr;
+    tx.clear();
+  }
+
+  size_t write(uint8_t c) override {
+    tx.push_back(c);
+    return 1;
+  }
+
+  // 0 on success, 2 when no device answers the address (as on the esp32)
+  uint8_t endTransmission(bool /*sendStop*/ = true) {
+    auto it = halI2cDevices.find(txAddr);
+    if (it == halI2cDevices.end())
+      return 2;
+    if (!tx.empty())
+      it->second->onWrite(tx.data(), int(tx.size()));
+    tx.clear();
+    return 0;
+  }
+
+  uint8_t requestFrom(uint8_t addr, uint8_t len) {
+    rx.assign(len, 0);
+    rxPos   = 0;
+    auto it = halI2cDevices.find(addr);
+    int n   = (it == halI2cDevices.end()) ? 0 : it->second->onRead(rx.data(), len);
+    rx.resize(n);
+    return n;
+  }
+
+  int available() override { return int(rx.size() - rxPos); }
+  int read() override { return (rxPos < rx.size()) ? rx[rxPos++] : -1; }
+
+private:
+  uint8_t txAddr = 0;
+  std::vector<uint8_t> tx, rx;
+  size_t rxPos = 0;
+};
+
+TwoWire Wire;
+
+// oled
+
+#define SSD1306_SWITCHCAPVCC 0x02
+#define BLACK 0
+#define WHITE 1
+
+const int cHalOledRows    = 8;
+const int cHalOledColumns = 21;
+
+// the ssd1306 as a text screen of 8 rows, display() copies the buffer to what is shown, and echoes
+// it to stderr when halOledEcho is set
+class Adafruit_SSD1306 : public Print {
+public:
+  Adafruit_SSD1306(int /*resetPin*/) { clearDisplay(); }
+
+  bool begin(uint8_t /*vcs*/, uint8_t /*addr*/) { return true; }
+  void setTextSize(uint8_t /*size*/) {}
+  void setTextColor(uint16_t /*fg*/, uint16_t /*bg*/ = BLACK) {}
+  void setRotation(uint8_t /*rotation*/) {}
+  void setCursor(int16_t x, int16_t y) {
+    column = x / 6;
+    row    = y / 8;
+  }
+
+  void clearDisplay() {
+    for (int r = 0; r < cHalOledRows; r++)
+      buffer[r] = std::string(cHalOledColumns, ' ');
+    row = column = 0;
+  }
+
+  void display() {
+    for (int r = 0; r < cHalOledRows; r++)
+      shown[r] = buffer[r];
+    if (echo) {
+      for (int r = 0; r < cHalOledRows; r++)
+        fprintf(stderr, "|%s|\n", shown[r].c_str());
+      fprintf(stderr, "\n");
+    }
+  }
+
+  size_t write(uint8_t c) override {
+    if (c == '\n') {
+      row++;
+      column = 0;
+    } else if (c != '\r' && row >= 0 && row < cHalOledRows && column < cHalOledColumns) {
+      buffer[row][column++] = char(c);
+    }
+    return 1;
+  }
+
+  // the text of a row as it is on the screen
+  const std::string& shownRow(int r) { return shown[r]; }
+  bool echo = false;
+
+private:
+  std::string buffer[cHalOledRows], shown[cHalOledRows];
+  int row = 0, column = 0;
+};
+
+// nvs
+
+// nvs, kept in memory for the lifetime of the process
+std::map<std::string, std::vector<uint8_t>> halNvs;
+
+class Preferences {
+public:
+  bool begin(const char* name, bool readOnly = false) {
+    space = name;
+    ro    = readOnly;
+    return true;
+  }
+  void end() {}
+
+  size_t putBytes(const char* key, const void* value, size_t len) {
+    if (ro)
+      return 0;
+    const uint8_t* bytes = (const uint8_t*)value;
+    halNvs[space + "/" + key].assign(bytes, bytes + len);
+    return len;
+  }
+
+  size_t getBytesLength(const char* key) {
+    auto it = halNvs.find(space + "/" + key);
+    return (it == halNvs.end()) ? 0 : it->second.size();
+  }
+
+  size_t getBytes(const char* key, void* buf, size_t maxLen) {
+    auto it = halNvs.find(space + "/" + key);
+    if (it == halNvs.end() || it->second.size() > maxLen)
+      return 0;
+    memcpy(buf, it->second.data(), it->second.size());
+    return it->second.size();
+  }
+
+  bool remove(const char* key) { return halNvs.erase(space + "/" + key) > 0; }
+
+private:
+  std::string space;
+  bool ro = false;
+};
+
+// freertos
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+// there are no interrupts to mask, a critical section is a mutex
+typedef std::mutex portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->lock()
+#define portEXIT_CRITICAL(mux) (mux)->unlock()
+
+// a task is a thread, its notification value is a counter guarded by a condition variable. it runs
+// on a painted stack of its own, much larger than the declared one, so the depth it has reached can
+// be measured (uxTaskGetStackHighWaterMark). the frames are x86-64 ones and the libraries under
+// the stubs are not the esp-idf ones, the depth is an estimate of the car's
+const size_t cHalTaskStackBytes = 1 << 20;
+const uint8_t cHalStackPaint    = 0xa5;
+
+struct halTask {
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint32_t notifications = 0;
+  uint32_t stackBytes    = 0;       // as declared
+  uint8_t* stackBottom   = nullptr; // of the painted stack, none for a thread the hal did not start
+  uint8_t* stackEntry    = nullptr; // where the task function was called from
+};
+typedef halTask* TaskHandle_t;
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+  static thread_local halTask self;
+  return &self;
+}
+
+struct halTaskStart {
+  void (*task)(void*);
+  void* parameter;
+  uint32_t stackBytes;
+  uint8_t* stackBottom;
+  std::mutex mutex;
+  std::condition_variable cv;
+  TaskHandle_t created = nullptr;
+};
+
+inline void* halTaskEntry(void* argument) {
+  halTaskStart* start = (halTaskStart*)argument;
+  void (*task)(void*) = start->task;
+  void* parameter     = start->parameter;
+  uint8_t entry;
+  {
+    // notify under the lock, the creator's locals are gone as soon as it has woken up
+    std::lock_guard<std::mutex> lock(start->mutex);
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    self->stackBytes  = start->stackBytes;
+    self->stackBottom = start->stackBottom;
+    self->stackEntry  = &entry;
+    start->created    = self;
+    start->cv.notify_one();
+  }
+  task(parameter);
+  return nullptr;
+}
+
+// the stack is never freed, the firmware's tasks do not end
+inline BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* /*name*/, uint32_t stack,
+                                          void* parameter, UBaseType_t /*priority*/,
+                                          TaskHandle_t* handle, BaseType_t /*core*/) {
+  halTaskStart start;
+  start.task        = task;
+  start.parameter   = parameter;
+  start.stackBytes  = stack;
+  start.stackBottom = (uint8_t*)aligned_alloc(4096, cHalTaskStackBytes);
+  memset(start.stackBottom, cHalStackPaint, cHalTaskStackBytes);
+
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstack(&attributes, start.stackBottom, cHalTaskStackBytes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  int failed = pthread_create(&thread, &attributes, halTaskEntry, &start);
+  pthread_attr_destroy(&attributes);
+  if (failed)
+    return pdFAIL;
+
+  std::unique_lock<std::mutex> lock(start.mutex);
+  start.cv.wait(lock, [&] { return start.created != nullptr; });
+  if (handle)
+    *handle = start.created;
+  return pdPASS;
+}
+
+inline void vTaskDelay(TickType_t ticks) { delay(ticks); }
+
+// the least stack the task has had left so far: the declared size less the depth the paint was
+// overwritten to below its entry. 0 for a thread the hal did not start
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  if (!task || !task->stackBottom)
+    return 0;
+  const uint8_t* deepest = task->stackBottom;
+  while (deepest < task->stackEntry && *deepest == cHalStackPaint)
+    deepest++;
+  size_t used = task->stackEntry - deepest;
+  return (used >= task->stackBytes) ? 0 : task->stackBytes - used;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  if (!task)
+    return pdFALSE;
+  {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    task->notifications++;
+  }
+  task->cv.notify_one();
+  return pdPASS;
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* /*higherPriorityTaskWoken*/) {
+  xTaskNotifyGive(task);
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(self->mutex);
+  auto ready = [self] { return self->notifications > 0; };
+  if (ticks == portMAX_DELAY)
+    self->cv.wait(lock, ready);
+  else
+    self->cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+
+  uint32_t value      = self->notifications;
+  self->notifications = clearOnExit ? 0 : (value > 0 ? value - 1 : 0);
+  return value;
+}
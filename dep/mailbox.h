@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/// @brief a value handed from one task to another, the reader always gets the latest value written
+/// and neither side ever waits. it is the triple buffer of the ccd frame pipeline (ccdPipeline.h)
+/// for any copyable type: the writer fills its back slot and swaps it into the middle with a single
+/// atomic exchange, the reader swaps the middle slot with its front slot when it holds a new value
+template <class T> class mailbox {
+public:
+  // writer side
+  void publish(const T& value) {
+    slots[back] = value;
+    uint8_t prev = middle.exchange(back | cFreshBit);
+    back         = prev & ~cFreshBit;
+  }
+
+  // reader side: copy the latest value out, returns whether it is new since the last read
+  bool read(T& value) {
+    bool fresh = middle.load() & cFreshBit;
+    if (fresh) {
+      uint8_t prev = middle.exchange(front);
+      front        = prev & ~cFreshBit;
+    }
+    value = slots[front];
+    return fresh;
+  }
+
+private:
+  static const uint8_t cFreshBit = 0x4; // set on the middle index when it holds an unread value
+
+  T slots[3]{};
+  std::atomic<uint8_t> middle{1};
+  uint8_t back  = 0; // owned by the writer
+  uint8_t front = 2; // owned by the reader
+};
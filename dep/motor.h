@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../args.h"
+#include "hal.h"
 #include "math.h"
 #include "oled.h"
 #include "pid.h"
@@ -12,19 +13,34 @@
 #define PWM_CHANNEL_RIGHT_MOTOR_FRONT 4
 #define PWM_CHANNEL_RIGHT_MOTOR_BACK 5
 
-const int cMotorResolution = 16; // Max: 16 bit
-const int cDefaultPower    = 24000;
-const int cMaximumPower    = 32000;
+const int cMotorResolution  = 16; // Max: 16 bit
+const int cDefaultPower     = 24000;
+const int cMaximumPower     = 32000;
+const float cFullPower      = (1 << cMotorResolution) - 1; // the duty the speed pid scales to
+const float cSpeedFilterS   = 0.1f; // s, derivative filter of the speed pid
+const float cBrakeOverspeed = 0.1f; // ticks / ms over the aim speed the motor brakes at
 
 int currentPower;
 float maxResolution = 0;
-pid motorPID(speed_kp, speed_ki, speed_kd);
+pid<float> motorPID(speed_kp, speed_ki, speed_kd);
+
+// the pid corrects the default power, within 0 and the maximum power, in fractions of full power so
+// its gains fit q16.16 as well (dep/pid.h). its derivative is on the measured speed only, a step of
+// the aim speed (platform approach) does not kick the motor
+template <class T> void configureSpeedPid(pid<T>& controller) {
+  controller.setOutputLimits(-cDefaultPower / cFullPower,
+                             (cMaximumPower - cDefaultPower) / cFullPower);
+  controller.setBackCalculation((speed_kp > 0) ? speed_ki / speed_kp : 0);
+  controller.setDerivativeFilter(cSpeedFilterS);
+  controller.setSetpointWeights(1, 0);
+}
 
 // init speed control, motor pins init, pwm init
 void initMotor() {
   initSpeedControl();
 
   currentPower = cDefaultPower;
+  configureSpeedPid(motorPID);
 
   ledcSetup(2, 1000, cMotorResolution); // Channel 1, 1kHz, 16 bit resolution
   ledcSetup(3, 1000, cMotorResolution); // Channel 2, 1kHz, 16 bit resolution
@@ -79,19 +95,21 @@ void motorBrake() {
 }
 
 // this motor forward function uses fixed speed, instead of fixed power, to drive the car regardless
-// the load
-void motorForward(float aimSpeed) {
+// the load. dt is the time in s since the previous call
+void motorForward(float aimSpeed, float dt) {
   if (aimSpeed == 0) {
     motorIdle();
     return;
   }
 
   float currentSpeed = getSpeed();
-  float delta        = aimSpeed - currentSpeed;
-  float p            = currentPower + motorPID.update(delta);
-
-  p = min(p, cMaximumPower);
+  float p            = currentPower + cFullPower * motorPID.update(aimSpeed, currentSpeed, dt);
 
-  clamp(currentPower, 0, cMaximumPower);
+  // without power the car only coasts down, too slowly for the aim speed to drop before a bend or a
+  // platform. well over the aim speed it brakes until the next call
+  if (currentSpeed > aimSpeed + cBrakeOverspeed) {
+    motorBrake();
+    return;
+  }
   motorControl(true, true, p, p);
 }
\ No newline at end of file
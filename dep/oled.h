@@ -1,7 +1,10 @@
 #pragma once
 
 // https://github.com/RalphBacon/ESP32-SSD1306-OLED/blob/master/ESP32_OLED_SSD1306_Adafruit.ino
+#ifdef ARDUINO
 #include "../lib/Adafruit_SSD1306/Adafruit_SSD1306.h"
+#endif
+#include "hal.h"
 #include "pinouts.h"
 
 const int cLineSpacing = 8;
@@ -1,33 +1,171 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "math.h"
 
-/// @brief this class aims to give user a higher lever control over the basic pid algorithm
-class pid {
+// the arithmetic of the value type a pid runs on. float is the default, the esp32 has a single
+// precision fpu. int32_t runs in q16.16 fixed point for targets without one: the range is +-32768,
+// the resolution 1 / 65536 = 1.5e-5, and its results saturate instead of wrapping around. every
+// gain, limit and signal of a q16.16 pid has to be within that range and well above the
+// resolution, the units of a loop are scaled until they are (the speed loop runs from ticks / ms
+// to a fraction of full power for that, dep/motor.h). fits() tells whether a value can be held
+template <class T> struct pidMath;
+
+template <> struct pidMath<float> {
+  static bool fits(float) { return true; }
+  static float fromFloat(float x) { return x; }
+  static float toFloat(float x) { return x; }
+  static float add(float a, float b) { return a + b; }
+  static float sub(float a, float b) { return a - b; }
+  static float mul(float a, float b) { return a * b; }
+  static float div(float a, float b) { return a / b; }
+  static float lowest() { return -3.4e38f; }
+  static float highest() { return 3.4e38f; }
+};
+
+template <> struct pidMath<int32_t> {
+  static int32_t saturate(int64_t x) {
+    return (x > INT32_MAX) ? INT32_MAX : ((x < INT32_MIN) ? INT32_MIN : int32_t(x));
+  }
+
+  static bool fits(float x) { return x >= -32768.0f && x <= 32768.0f; }
+
+  static int32_t fromFloat(float x) {
+    float scaled = x * 65536.0f;
+    if (scaled >= 2147483647.0f)
+      return INT32_MAX;
+    if (scaled <= -2147483648.0f)
+      return INT32_MIN;
+    return int32_t(scaled + ((scaled < 0) ? -0.5f : 0.5f));
+  }
+
+  static float toFloat(int32_t x) { return float(x) / 65536.0f; }
+  static int32_t add(int32_t a, int32_t b) { return saturate(int64_t(a) + b); }
+  static int32_t sub(int32_t a, int32_t b) { return saturate(int64_t(a) - b); }
+  static int32_t mul(int32_t a, int32_t b) {
+    // rounded to the nearest, truncating would drift an integrator
+    int64_t product = int64_t(a) * b;
+    return saturate((product + ((product < 0) ? -32768 : 32768)) / 65536);
+  }
+  static int32_t div(int32_t a, int32_t b) {
+    if (b == 0)
+      return (a >= 0) ? INT32_MAX : INT32_MIN;
+    return saturate(int64_t(a) * 65536 / b);
+  }
+  static int32_t lowest() { return INT32_MIN; }
+  static int32_t highest() { return INT32_MAX; }
+};
+
+/// @brief a pid controller on a measured time base: the integral and the derivative use the dt of
+/// every update, so the gains are per second and hold at any loop rate. the output is limited, the
+/// integrator is clamped to the output limits and unwound by back-calculation while the output
+/// saturates, the derivative goes through a first order filter, and the setpoint can be weighted
+/// in the proportional and the derivative term. T is the value type (float, or int32_t for q16.16
+/// fixed point), Policy its arithmetic. a parameter T cannot hold is saturated, inRange() is false
+/// as long as one is
+template <class T = float, class Policy = pidMath<T>> class pid {
 public:
   pid(float kp, float ki, float kd) {
-    Kp = kp;
-    Ki = ki;
-    Kd = kd;
+    setGains(kp, ki, kd);
+    setOutputLimits(Policy::toFloat(Policy::lowest()), Policy::toFloat(Policy::highest()));
+  }
+
+  void setGains(float kp, float ki, float kd) {
+    Kp = Policy::fromFloat(kp);
+    Ki = Policy::fromFloat(ki);
+    Kd = Policy::fromFloat(kd);
+    checkRange(cGainsParameter, Policy::fits(kp) && Policy::fits(ki) && Policy::fits(kd));
+  }
+
+  void setOutputLimits(float minimum, float maximum) {
+    outMin = Policy::fromFloat(minimum);
+    outMax = Policy::fromFloat(maximum);
+    checkRange(cLimitsParameter, Policy::fits(minimum) && Policy::fits(maximum));
   }
 
-  float update(float error, float t = 1) {
-    P         = error;
-    I         = I + error;
-    D         = error - previous_error;
-    PID_value = ((Kp * P) + (Ki * I) + (Kd * D)) * t;
+  // time constant of the derivative filter in s, 0 differentiates unfiltered
+  void setDerivativeFilter(float timeConstant) {
+    Tf = Policy::fromFloat(timeConstant);
+    checkRange(cFilterParameter, Policy::fits(timeConstant));
+  }
 
-    previous_error = error;
-    return PID_value;
+  // the setpoint enters the proportional term weighted by b and the derivative term by c, with
+  // c = 0 a setpoint step does not kick the derivative
+  void setSetpointWeights(float b, float c) {
+    B = Policy::fromFloat(b);
+    C = Policy::fromFloat(c);
+    checkRange(cWeightsParameter, Policy::fits(b) && Policy::fits(c));
+  }
+
+  // gain (1 / s) the integrator is unwound with by the part of the output cut off by the limits,
+  // Ki / Kp is the usual choice, 0 leaves it to the clamping
+  void setBackCalculation(float gain) {
+    Kt = Policy::fromFloat(gain);
+    checkRange(cBackParameter, Policy::fits(gain));
+  }
+
+  // whether T holds every parameter as it was set
+  bool inRange() const { return outOfRange == 0; }
+
+  // one step, dt in s since the previous one. the first step after a reset has no derivative term,
+  // a step with dt <= 0 neither integrates
+  float update(float setpoint, float measurement, float dt) {
+    return Policy::toFloat(updateRaw(Policy::fromFloat(setpoint), Policy::fromFloat(measurement),
+                                     Policy::fromFloat(dt)));
+  }
+
+  // the same on values of T
+  T updateRaw(T setpoint, T measurement, T dt) {
+    T error    = Policy::sub(setpoint, measurement);
+    T weighted = Policy::sub(Policy::mul(C, setpoint), measurement);
+    T P        = Policy::mul(Kp, Policy::sub(Policy::mul(B, setpoint), measurement));
+
+    // backward euler of the filter: D += (raw - D) * dt / (Tf + dt)
+    if (started && dt > 0) {
+      T raw   = Policy::div(Policy::mul(Kd, Policy::sub(weighted, previous)), dt);
+      T alpha = Policy::div(dt, Policy::add(Tf, dt));
+      D       = Policy::add(D, Policy::mul(Policy::sub(raw, D), alpha));
+    }
+    previous = weighted;
+    started  = true;
+
+    T unlimited = Policy::add(Policy::add(P, I), D);
+    T output    = unlimited;
+    clamp(output, outMin, outMax);
+
+    if (dt > 0) {
+      T rate = Policy::add(Policy::mul(Ki, error), Policy::mul(Kt, Policy::sub(output, unlimited)));
+      I      = Policy::add(I, Policy::mul(rate, dt));
+      clamp(I, outMin, outMax);
+    }
+    return output;
   }
 
   void reset() {
-    I              = 0;
-    previous_error = 0;
+    I = D = previous = 0;
+    started          = false;
   }
 
 private:
-  float Kp = 0.9f, Ki = 0.1, Kd = 0.1;
-  float P = 0, I = 0, D = 0, PID_value = 0;
-  float previous_error = 0;
-};
\ No newline at end of file
+  // the parameters out of the range of T, a bit each
+  static const unsigned cGainsParameter   = 1;
+  static const unsigned cLimitsParameter  = 2;
+  static const unsigned cFilterParameter  = 4;
+  static const unsigned cWeightsParameter = 8;
+  static const unsigned cBackParameter    = 16;
+
+  void checkRange(unsigned parameter, bool fits) {
+    outOfRange = fits ? (outOfRange & ~parameter) : (outOfRange | parameter);
+  }
+
+  unsigned outOfRange = 0;
+
+  T Kp = 0, Ki = 0, Kd = 0;
+  T Kt = 0, Tf = 0;
+  T B = Policy::fromFloat(1), C = Policy::fromFloat(1);
+  T outMin = 0, outMax = 0;
+
+  T I = 0, D = 0, previous = 0;
+  bool started = false;
+};
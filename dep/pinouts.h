@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../args.h"
+
 // GPIO 34 - 39 can only be set as input mode and do not have software-enabled pullup or pulldown
 // functions. ADC pins: 0, 2, 4, 12 - 15, 25 - 39
 
@@ -9,7 +11,11 @@
 
 #define PINOUT_CCD_SI 14  // GPO
 #define PINOUT_CCD_CLK 12 // GPO
-#define PINOUT_CCD_AO 13  // ADC pin required
+#ifdef CCD_DMA_ON
+#define PINOUT_CCD_AO 34 // ADC1 pin required (i2s adc)
+#else
+#define PINOUT_CCD_AO 13 // ADC pin required
+#endif
 
 #define PINOUT_SERVO 18 // PWM pin required
 
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+
+/// @brief debounces the platform bar seen by the ccd. every frame is reduced to its black ratio, a
+/// platform is confirmed once `hitsToEnter` of the last `window` frames are above the enter ratio,
+/// or once those of them cover `confirmTravel` of the ground: the faster the car, the fewer frames
+/// the bar is seen in. it is only released once `window` frames in a row are below the (lower)
+/// exit ratio. a smoothed black ratio that keeps rising raises an early approaching flag, so the
+/// car can slow down before the bar is confirmed. all the work per frame is a few compares and a
+/// popcount, and a sum over the window
+class platformDetector {
+public:
+  enum state { CLEAR, APPROACHING, CONFIRMED };
+
+  platformDetector(float enterRatio, float exitRatio, int hitsToEnter, int window,
+                   float confirmTravel, float approachRatio, float approachSlope) {
+    enterLevel   = enterRatio;
+    exitLevel    = exitRatio;
+    hitsNeeded   = hitsToEnter;
+    windowFrames = (window >= 32) ? 32 : window;
+    frameMask    = (window >= 32) ? ~0u : (1u << window) - 1;
+    travelNeeded = confirmTravel;
+    approach   = approachRatio;
+    slopeMin   = approachSlope;
+  }
+
+  /// @brief feed the black ratio of one frame and the ground travelled since the one before (m, 0
+  /// when it is not known), returns the new state
+  state update(float blackRatio, float travel = 0) {
+    hits = ((hits << 1) | (blackRatio > enterLevel ? 1u : 0u)) & frameMask;
+    lows = ((lows << 1) | (blackRatio < exitLevel ? 1u : 0u)) & frameMask;
+
+    travelHead              = (travelHead + 1) % cTravelFrames;
+    frameTravel[travelHead] = travel;
+
+    // smoothed black ratio and its per frame change
+    float prevSmoothed = smoothed;
+    smoothed += cSmoothing * (blackRatio - smoothed);
+    slope += cSmoothing * ((smoothed - prevSmoothed) - slope);
+
+    if (current == CONFIRMED) {
+      // hysteresis: stay confirmed until the bar has been left for a whole window
+      if (lows == frameMask)
+        current = CLEAR;
+      return current;
+    }
+
+    if (__builtin_popcount(hits) >= hitsNeeded || hitTravel() >= travelNeeded) {
+      current      = CONFIRMED;
+      approachHold = 0;
+      confirmedCount++;
+      return current;
+    }
+
+    if (smoothed > approach && slope > slopeMin)
+      approachHold = cApproachHoldFrames;
+    else if (approachHold > 0)
+      approachHold--;
+
+    current = (approachHold > 0 || hits != 0) ? APPROACHING : CLEAR;
+    return current;
+  }
+
+  void reset() {
+    hits         = 0;
+    lows         = 0;
+    smoothed     = 0;
+    slope        = 0;
+    approachHold = 0;
+    current      = CLEAR;
+    travelHead   = 0;
+    for (int n = 0; n < cTravelFrames; n++)
+      frameTravel[n] = 0;
+  }
+
+  state getState() { return current; }
+  bool isConfirmed() { return current == CONFIRMED; }
+  bool isApproaching() { return current == APPROACHING; }
+  float blackRatio() { return smoothed; }
+  unsigned long confirmations() { return confirmedCount; }
+
+private:
+  static const int cTravelFrames = 32;
+  const float cSmoothing         = 0.3f;
+  const int cApproachHoldFrames  = 10; // keep slowing down a little after the ratio stops rising
+
+  // the ground the frames above the enter ratio in the window stand for, none without a hit
+  float hitTravel() {
+    if (hits == 0 || travelNeeded <= 0)
+      return 0;
+    float covered = 0;
+    for (int n = 0; n < windowFrames; n++)
+      if (hits & (1u << n))
+        covered += frameTravel[(travelHead + cTravelFrames - n) % cTravelFrames];
+    return covered;
+  }
+
+  float enterLevel = 0, exitLevel = 0, approach = 0, slopeMin = 0, travelNeeded = 0;
+  int hitsNeeded = 0, windowFrames = 0;
+  uint32_t frameMask = 0;
+
+  uint32_t hits = 0; // bit n set: the frame n frames ago was above the enter ratio
+  uint32_t lows = 0; // bit n set: the frame n frames ago was below the exit ratio
+
+  float frameTravel[cTravelFrames]{}; // m, of the frames in the order they came, a ring
+  int travelHead = 0;                 // the last frame
+
+  float smoothed = 0, slope = 0;
+  int approachHold = 0;
+  state current    = CLEAR;
+
+  unsigned long confirmedCount = 0;
+};
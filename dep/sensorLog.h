@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+
+#include "hal.h"
+#include "sensorLogFormat.h"
+
+// the sensor log recorder (format in sensorLogFormat.h). the control code appends records at the
+// points where it reads a sensor or writes an actuator, each append copies the record into a byte
+// ring and never blocks. the tracking loop and the control task both append, so the copy is a
+// short critical section, the ring has a single consumer: a background task on core 0 drains it to
+// a stream, when the link cannot keep up whole records are dropped and counted. while the log is
+// not started, an append is a single branch
+
+const uint32_t cSensorLogRingSize    = 4096; // power of two
+const int cSensorLogTaskStack        = 2048;
+const int cSensorLogTaskPriority     = 1;
+const int cSensorLogIdleMs           = 5;
+const uint8_t cSensorLogServoChannel = 0;
+const uint8_t cSensorLogMotorChannel = 2; // the first of the four motor channels
+
+uint8_t sensorLogRing[cSensorLogRingSize];
+std::atomic<uint32_t> sensorLogHead{0}; // written by the producer only
+std::atomic<uint32_t> sensorLogTail{0}; // written by the consumer only
+
+bool sensorLogRunning        = false;
+unsigned long sensorLogDrops = 0;
+Stream* sensorLogOut         = NULL;
+portMUX_TYPE sensorLogMux    = portMUX_INITIALIZER_UNLOCKED;
+
+sensorLogActuator sensorLogLastActuator{};
+bool sensorLogHasActuator = false;
+
+void sensorLogCopyIn(uint32_t pos, const void* data, uint32_t size) {
+  uint32_t at    = pos & (cSensorLogRingSize - 1);
+  uint32_t first = min(size, cSensorLogRingSize - at);
+  memcpy(sensorLogRing + at, data, first);
+  memcpy(sensorLogRing, (const uint8_t*)data + first, size - first);
+}
+
+// producer side, records of different tasks are serialized by the critical section. the header and
+// its checksum are made on the stack before, the lock is only held for the copy into the ring
+void sensorLogAppend(uint8_t type, const void* payload, uint16_t size) {
+  if (!sensorLogRunning)
+    return;
+
+  sensorLogRecordHeader header;
+  sensorLogInitRecord(header, type, payload, size, micros());
+  uint32_t total = sizeof(sensorLogRecordHeader) + sensorLogPadded(size);
+
+  portENTER_CRITICAL(&sensorLogMux);
+  uint32_t head = sensorLogHead.load(std::memory_order_relaxed);
+  if (head - sensorLogTail.load(std::memory_order_acquire) + total > cSensorLogRingSize) {
+    sensorLogDrops++;
+    portEXIT_CRITICAL(&sensorLogMux);
+    return;
+  }
+
+  sensorLogCopyIn(head, &header, sizeof(header));
+  sensorLogCopyIn(head + sizeof(header), payload, size);
+  const uint8_t padding[4] = {0, 0, 0, 0};
+  sensorLogCopyIn(head + sizeof(header) + size, padding, sensorLogPadded(size) - size);
+
+  sensorLogHead.store(head + total, std::memory_order_release);
+  portEXIT_CRITICAL(&sensorLogMux);
+}
+
+// consumer side: write what the ring holds to the log stream, returns false if it was empty
+bool sensorLogDrain() {
+  uint32_t tail = sensorLogTail.load(std::memory_order_relaxed);
+  uint32_t head = sensorLogHead.load(std::memory_order_acquire);
+  if (head == tail)
+    return false;
+
+  // the contiguous part up to the end of the ring first
+  while (tail != head) {
+    uint32_t at   = tail & (cSensorLogRingSize - 1);
+    uint32_t size = min(head - tail, cSensorLogRingSize - at);
+    sensorLogOut->write(sensorLogRing + at, size);
+    tail += size;
+    sensorLogTail.store(tail, std::memory_order_release);
+  }
+  return true;
+}
+
+void sensorLogTask(void* /*pvParameters*/) {
+  for (;;) {
+    if (!sensorLogDrain())
+      delay(cSensorLogIdleMs);
+  }
+}
+
+// write the file header and start recording to out. the ring is drained by a task of its own, or
+// by the caller with sensorLogDrain() if drainTask is false (the host simulator does so on its
+// virtual clock)
+void sensorLogStart(Stream& out, bool drainTask = true) {
+  if (sensorLogRunning)
+    return;
+
+  sensorLogFileHeader header;
+  sensorLogInitFileHeader(header);
+  out.write((const uint8_t*)&header, sizeof(header));
+
+  sensorLogOut     = &out;
+  sensorLogRunning = true;
+  if (drainTask)
+    xTaskCreatePinnedToCore(sensorLogTask, "SensorLog", cSensorLogTaskStack, NULL,
+                            cSensorLogTaskPriority, NULL, 0);
+}
+
+// the helpers below are the record points used by the firmware
+
+void sensorLogFrame(uint32_t seq, int explosureTime, const uint8_t* samples) {
+  if (!sensorLogRunning)
+    return;
+  sensorLogCCD record;
+  record.seq           = seq;
+  record.explosureTime = explosureTime;
+  record.reserved      = 0;
+  memcpy(record.samples, samples, sizeof(record.samples));
+  sensorLogAppend(SENSOR_LOG_CCD, &record, sizeof(record));
+}
+
+void sensorLogEncoderTicks(uint32_t ticks, uint32_t lastEdgeUs) {
+  sensorLogEncoder record{ticks, lastEdgeUs};
+  sensorLogAppend(SENSOR_LOG_ENCODER, &record, sizeof(record));
+}
+
+void sensorLogColorRead(const uint16_t* rgb) {
+  sensorLogColor record{{rgb[0], rgb[1], rgb[2]}, 0};
+  sensorLogAppend(SENSOR_LOG_COLOR, &record, sizeof(record));
+}
+
+// snapshot of all actuator duties, called at the end of every control step. a snapshot equal to
+// the last one is not logged, nothing changes while the car stands or holds its steering angle
+void sensorLogActuators() {
+  if (!sensorLogRunning)
+    return;
+  sensorLogActuator record;
+  record.servoDuty = ledcRead(cSensorLogServoChannel);
+  for (int i = 0; i < 4; i++)
+    record.motorDuty[i] = ledcRead(cSensorLogMotorChannel + i);
+  if (sensorLogHasActuator && memcmp(&record, &sensorLogLastActuator, sizeof(record)) == 0)
+    return;
+  sensorLogLastActuator = record;
+  sensorLogHasActuator  = true;
+  sensorLogAppend(SENSOR_LOG_ACTUATOR, &record, sizeof(record));
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ccdTelemetryFormat.h"
+
+// the sensor log: what the car saw (ccd frames, encoder ticks, colour reads) and what it did
+// (actuator commands), recorded by sensorLog.h and replayed on linux by host/sensorReplay.cpp.
+//
+// a log is a file header followed by records. every record is a fixed header and a payload padded
+// to 4 bytes, so a log written in one piece is aligned and can be memory mapped and walked in
+// place. each record carries a sync word and a checksum, which lets the reader skip anything that
+// is not a record, e.g. debug text printed to the same serial line the log was captured from (the
+// records after it may then be unaligned, they are read with memcpy). all fields are little endian
+
+const char cSensorLogMagic[4]    = {'B', 'C', 'L', 'G'};
+const uint16_t cSensorLogVersion = 2;
+const uint16_t cSensorLogSync    = 0xB10C;
+const uint16_t cSensorLogMaxSize = 256; // payload bytes of the largest record
+
+enum sensorLogType : uint8_t {
+  SENSOR_LOG_CCD      = 1,
+  SENSOR_LOG_ENCODER  = 2,
+  SENSOR_LOG_COLOR    = 3,
+  SENSOR_LOG_ACTUATOR = 4,
+};
+
+struct sensorLogFileHeader {
+  char magic[4];
+  uint16_t version;
+  uint16_t headerSize; // of this struct, records start right after it
+  uint32_t reserved[2];
+};
+
+struct sensorLogRecordHeader {
+  uint16_t sync;
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t size;     // payload bytes, without padding
+  uint16_t checksum; // fletcher-16 of the payload
+  uint32_t timestampUs;
+};
+
+// a ccd frame as it was handed to the tracking code, after the flat field correction
+struct sensorLogCCD {
+  uint32_t seq;
+  uint16_t explosureTime;
+  uint16_t reserved;
+  uint8_t samples[cCCDTelemetrySamples];
+};
+
+// encoder edges since the previous encoder record, and the micros() of the last of them (valid when
+// ticks > 0), which is all the speed estimate (speedControl.h) uses of the edges
+struct sensorLogEncoder {
+  uint32_t ticks;
+  uint32_t lastEdgeUs;
+};
+
+// the raw values of the colour sensor
+struct sensorLogColor {
+  uint16_t rgb[3];
+  uint16_t reserved;
+};
+
+// the duties written to the servo and the four motor pwm channels
+struct sensorLogActuator {
+  uint32_t servoDuty;
+  uint32_t motorDuty[4];
+};
+
+inline uint32_t sensorLogPadded(uint32_t size) { return (size + 3) & ~3u; }
+
+inline void sensorLogInitFileHeader(sensorLogFileHeader& header) {
+  for (int i = 0; i < 4; i++)
+    header.magic[i] = cSensorLogMagic[i];
+  header.version     = cSensorLogVersion;
+  header.headerSize  = sizeof(sensorLogFileHeader);
+  header.reserved[0] = 0;
+  header.reserved[1] = 0;
+}
+
+inline bool sensorLogValidFileHeader(const sensorLogFileHeader& header) {
+  for (int i = 0; i < 4; i++)
+    if (header.magic[i] != cSensorLogMagic[i])
+      return false;
+  return header.version == cSensorLogVersion && header.headerSize >= sizeof(sensorLogFileHeader);
+}
+
+// fill a record header, the checksum is the same fletcher-16 as the ccd telemetry
+inline void sensorLogInitRecord(sensorLogRecordHeader& header, uint8_t type, const void* payload,
+                                uint16_t size, uint32_t timestampUs) {
+  header.sync        = cSensorLogSync;
+  header.type        = type;
+  header.reserved    = 0;
+  header.size        = size;
+  header.checksum    = ccdTelemetryChecksum((const uint8_t*)payload, size);
+  header.timestampUs = timestampUs;
+}
+
+// the offset of the first valid record at or after `offset` in a log of `length` bytes, or length
+// if there is none, its header is copied to `header`
+inline uint32_t sensorLogFind(const uint8_t* log, uint32_t length, uint32_t offset,
+                              sensorLogRecordHeader& header) {
+  for (; offset + sizeof(sensorLogRecordHeader) <= length; offset++) {
+    if (log[offset] != (cSensorLogSync & 0xff) || log[offset + 1] != (cSensorLogSync >> 8))
+      continue;
+    memcpy(&header, log + offset, sizeof(header));
+    if (header.size > cSensorLogMaxSize ||
+        offset + sizeof(sensorLogRecordHeader) + header.size > length)
+      continue;
+    if (header.checksum == ccdTelemetryChecksum(log + offset + sizeof(header), header.size))
+      return offset;
+  }
+  return length;
+}
+
+// the offset right after a record, the padding of the last record of a log may be cut off
+inline uint32_t sensorLogAfter(uint32_t offset, const sensorLogRecordHeader& header) {
+  return offset + sizeof(sensorLogRecordHeader) + sensorLogPadded(header.size);
+}
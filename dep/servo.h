@@ -1,5 +1,6 @@
 #pragma once
 
+#include "hal.h"
 #include "math.h"
 #include "pinouts.h"
 
@@ -34,6 +35,6 @@ void servoWriteAngle(float angle) {
 }
 
 // simple angle mapping function: DO NOT DIRECTLY CALL THIS FUNCTION
-void servoWritePixel(int trackMidPoint) {
-  servoWriteAngle(map(float(trackMidPoint), 0.0f, 128.0f, -cAngleLimit, cAngleLimit));
+void servoWritePixel(float trackMidPoint) {
+  servoWriteAngle(map(trackMidPoint, 0.0f, 128.0f, -cAngleLimit, cAngleLimit));
 }
\ No newline at end of file
@@ -1,14 +1,31 @@
 #pragma once
 
 #include "boardLed.h"
+#include "channel.h"
+#include "hal.h"
 #include "pinouts.h"
+#include "sensorLog.h"
 
+// the hall interrupt stamps every encoder edge with micros() into a lock-free ring (channel.h),
+// getSpeed() takes the edges out. the speed is the edges since the previous call over the time from
+// the last edge before it to the last edge now (count over period): its resolution is that of
+// micros() at any speed, and with a single edge per call it is the period of that edge. without a
+// new edge the car is at most as fast as one edge over the time since the last one, so a slowing
+// car reads down to 0 instead of holding its last speed. a first order low pass smooths the result
 
-unsigned long lastTime    = 0;
-unsigned long currentTime = 0;
-unsigned long deltaTime   = 0;
+const uint32_t cEncoderRingSize = 128;    // power of two, edges between two getSpeed() calls
+const float cEncoderFilterS     = 0.02f;  // s, time constant of the low pass, 0 is unfiltered
+const uint32_t cEncoderStopUs   = 250000; // without an edge for this long the car stands
 
-unsigned long rotateCount = 0;
+spscRing<uint32_t, cEncoderRingSize> encoderEdges; // edge times in us
+unsigned long encoderOverflows = 0;                 // edges dropped, the ring was full
+
+// owned by getSpeed()
+uint32_t encoderLastEdgeUs = 0;
+bool encoderHasEdge        = false;
+uint32_t lastSpeedUs       = 0;
+float encoderRawSpeed      = 0; // ticks / ms
+float encoderSpeed         = 0; // ticks / ms, filtered
 
 void resetSpeedCount();
 float getSpeed();
@@ -21,25 +38,54 @@ void initSpeedControl() {
 }
 
 void resetSpeedCount() {
-  lastTime    = 0;
-  currentTime = 0;
-  rotateCount = 0;
+  encoderEdges.clear();
+  encoderHasEdge  = false;
+  lastSpeedUs     = 0;
+  encoderRawSpeed = 0;
+  encoderSpeed    = 0;
 }
 
-float getSpeed() {
-  float speed = 0;
+// producer side, an edge at edgeUs
+void IRAM_ATTR encoderPushEdge(uint32_t edgeUs) {
+  if (!encoderEdges.push(edgeUs))
+    encoderOverflows++;
+}
 
-  currentTime = millis();
-  deltaTime   = currentTime - lastTime;
-  lastTime    = currentTime;
+// the speed from `ticks` new edges, the last of them at lastEdgeUs
+float encoderUpdate(uint32_t ticks, uint32_t lastEdgeUs, uint32_t nowUs) {
+  if (ticks > 0) {
+    uint32_t periodUs = lastEdgeUs - encoderLastEdgeUs;
+    if (encoderHasEdge && periodUs > 0)
+      encoderRawSpeed = 1000.0f * ticks / periodUs;
+    encoderLastEdgeUs = lastEdgeUs;
+    encoderHasEdge    = true;
+  } else if (!encoderHasEdge || nowUs - encoderLastEdgeUs > cEncoderStopUs) {
+    encoderRawSpeed = 0;
+  } else if (nowUs != encoderLastEdgeUs) {
+    encoderRawSpeed = min(encoderRawSpeed, 1000.0f / (nowUs - encoderLastEdgeUs));
+  }
 
-  speed       = float(rotateCount) / float(deltaTime);
-  rotateCount = 0;
+  float dt    = (lastSpeedUs == 0) ? 0 : (nowUs - lastSpeedUs) * 1e-6f;
+  lastSpeedUs = nowUs;
+  if (cEncoderFilterS <= 0 || dt <= 0)
+    encoderSpeed = encoderRawSpeed;
+  else
+    encoderSpeed += (encoderRawSpeed - encoderSpeed) * dt / (cEncoderFilterS + dt);
+  return encoderSpeed;
+}
 
-  return speed;
+// the speed in ticks / ms, consumer side of the edge ring
+float getSpeed() {
+  uint32_t nowUs = micros();
+  uint32_t ticks = 0, lastEdgeUs = 0;
+  for (uint32_t edgeUs; encoderEdges.pop(edgeUs); ticks++)
+    lastEdgeUs = edgeUs;
+
+  sensorLogEncoderTicks(ticks, lastEdgeUs);
+  return encoderUpdate(ticks, lastEdgeUs, nowUs);
 }
 
-void motorCountInterrupt() {
-  rotateCount++;
+void IRAM_ATTR motorCountInterrupt() {
+  encoderPushEdge(micros());
 //   flipBoardLed();
-}
\ No newline at end of file
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../args.h"
+#include "hal.h"
+
+// the geometry of the car (car_*, encoder_ticks_per_m) is in args.h
+
+// time constants of the curvature estimate
+const float cPlanCurvatureRise = 0.02f; // s
+const float cPlanCurvatureFall = 0.3f;  // s
+
+/// @brief plans the aim speed from the curvature of the track: the top speed on straights, and in
+/// a bend the speed that keeps the lateral acceleration v^2 * curvature under the limit. the
+/// curvature is the larger of two estimates: the steering, which is the bend the car is driving
+/// (bicycle model), and the track centre at the sensor, previewed on with its rate, which is the
+/// bend ahead (a line that curves away by k from the heading is off by k d^2 / 2 at distance d).
+/// the estimate rises quickly and falls slowly, so the car slows down before a bend and stays slow
+/// through it. the planned speed drops at once and comes back up at the acceleration limit
+class speedPlanner {
+public:
+  speedPlanner(float lateralAccel, float longitudinalAccel, float minSpeed, float previewTime) {
+    lateralLimit = lateralAccel;
+    accelLimit   = longitudinalAccel;
+    minimum      = minSpeed;
+    preview      = previewTime;
+    planned      = minSpeed;
+  }
+
+  /// @brief one step of dt seconds. trackOffset and trackRate are the track centre (pixels off the
+  /// sensor axis) and its rate (pixels / s), wheelDeg the steering angle of the wheels. returns the
+  /// aim speed, at most topSpeed
+  float update(float trackOffset, float trackRate, float wheelDeg, float topSpeed, float dt) {
+    float ahead  = (trackOffset + trackRate * preview) * car_sensor_pitch;
+    float lineK  = 2 * fabsf(ahead) / (car_sensor_ahead * car_sensor_ahead);
+    float steerK = fabsf(tanf(wheelDeg * float(M_PI) / 180)) / car_wheelbase;
+    float k      = max(lineK, steerK);
+
+    float tau = (k > curvature) ? cPlanCurvatureRise : cPlanCurvatureFall;
+    curvature += (k - curvature) * dt / (tau + dt);
+
+    // v^2 k <= a, in m / s and back to ticks / ms
+    float limit = topSpeed;
+    if (curvature > 0)
+      limit = min(limit, sqrtf(lateralLimit / curvature) * encoder_ticks_per_m / 1000);
+    limit = max(limit, min(minimum, topSpeed));
+
+    if (limit < planned)
+      planned = limit;
+    else
+      planned = min(limit, planned + accelLimit * dt * encoder_ticks_per_m / 1000);
+    return planned;
+  }
+
+  /// @brief the car stopped, it starts again from the minimum speed
+  void reset() {
+    curvature = 0;
+    planned   = minimum;
+  }
+
+  float getCurvature() { return curvature; }
+  float getPlanned() { return planned; }
+
+private:
+  float lateralLimit = 0, accelLimit = 0, minimum = 0, preview = 0;
+  float curvature = 0, planned = 0;
+};
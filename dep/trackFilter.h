@@ -0,0 +1,99 @@
+#pragma once
+
+#include "math.h"
+
+/// @brief a constant velocity kalman filter over the track centre seen by the ccd. the state is the
+/// lateral position (pixels) and its rate (pixels / s). measurements are weighted by their
+/// confidence, and the state can be predicted on through short sensor dropouts
+class trackFilter {
+public:
+  trackFilter(float processNoise, float measurementNoise, int maxCoastFrames) {
+    q        = processNoise;
+    r        = measurementNoise;
+    maxCoast = maxCoastFrames;
+  }
+
+  /// @brief move the state dt seconds forward
+  void predict(float dt) {
+    if (!initialized)
+      return;
+
+    x += v * dt;
+
+    // P = F P F' + Q, with a white acceleration noise model
+    float dt2 = dt * dt;
+    float p00 = P00 + dt * (P01 + P10) + dt2 * P11 + q * dt2 * dt2 / 4;
+    float p01 = P01 + dt * P11 + q * dt2 * dt / 2;
+    float p10 = P10 + dt * P11 + q * dt2 * dt / 2;
+    float p11 = P11 + q * dt2;
+    P00       = p00;
+    P01       = p01;
+    P10       = p10;
+    P11       = p11;
+  }
+
+  /// @brief fuse a measured position, confidence in (0, 1] scales the measurement noise down
+  void update(float measurement, float confidence) {
+    coastFrames = 0;
+
+    if (!initialized) {
+      x           = measurement;
+      v           = 0;
+      P00         = r;
+      P01         = 0;
+      P10         = 0;
+      P11         = cInitialRateVariance;
+      initialized = true;
+      return;
+    }
+
+    float R  = r / max(confidence, 0.05f);
+    float y  = measurement - x;
+    float S  = P00 + R;
+    float K0 = P00 / S;
+    float K1 = P10 / S;
+
+    x += K0 * y;
+    v += K1 * y;
+
+    float p00 = (1 - K0) * P00;
+    float p01 = (1 - K0) * P01;
+    float p10 = P10 - K1 * P00;
+    float p11 = P11 - K1 * P01;
+    P00       = p00;
+    P01       = p01;
+    P10       = p10;
+    P11       = p11;
+  }
+
+  /// @brief a frame without measurement, returns false once the dropout has lasted too long to
+  /// trust the prediction any more
+  bool coast() {
+    if (!initialized || coastFrames >= maxCoast)
+      return false;
+    coastFrames++;
+    return true;
+  }
+
+  void reset() {
+    initialized = false;
+    coastFrames = 0;
+    x = v = 0;
+  }
+
+  /// @brief the filtered position, led by `lead` seconds to make up for the capture latency
+  float position(float lead = 0) { return x + v * lead; }
+  float rate() { return v; }
+  bool isCoasting() { return coastFrames > 0; }
+
+private:
+  const float cInitialRateVariance = 1e4f;
+
+  float q = 0, r = 0;
+  int maxCoast    = 0;
+  int coastFrames = 0;
+
+  bool initialized = false;
+  float x = 0, v = 0;
+  float P00 = 0, P01 = 0, P10 = 0, P11 = 0;
+};
@@ -0,0 +1,144 @@
+// offline decoder of the binary ccd telemetry (CCD_TELEMETRY_ON in args.h). reads a raw capture of
+// the serial / bluetooth stream and prints either the ascii views the car used to print itself
+// (linear, binary and one hot lines) or one csv row per frame
+//
+// build: g++ -std=c++11 -O2 -o ccdTelemetryDecode host/ccdTelemetryDecode.cpp
+// usage: ccdTelemetryDecode [--csv] [capture.bin]      (reads stdin without a file)
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "../dep/ccdTelemetryFormat.h"
+
+// the counting window of dep/ccd.h, pixels outside of it are never dark
+const int cCountStart = 15;
+const int cCountEnd   = 126;
+
+const char* statusName(int status) {
+  switch (status) {
+  case 0:
+    return "NORMAL";
+  case 1:
+    return "NO_TRACK";
+  case 2:
+    return "PLATFORM";
+  case 3:
+    return "COASTING";
+  }
+  return "?";
+}
+
+void printAscii(const ccdTelemetryRecord& record) {
+  char line[cCCDTelemetrySamples + 1];
+  line[cCCDTelemetrySamples] = '\0';
+
+  printf("#%u %ums expl %u thr %u %s%s\n", record.seq, record.timestampMs, record.explosureTime,
+         record.threshold, statusName(record.status),
+         (record.flags & cCCDTelemetryApproach) ? " approaching" : "");
+
+  int maxVal = 1;
+  for (int i = cCountStart; i <= cCountEnd; i++)
+    if (record.samples[i] > maxVal)
+      maxVal = record.samples[i];
+
+  // linear view, 0..9 relative to the brightest pixel of the counting window
+  for (int i = 0; i < cCCDTelemetrySamples; i++) {
+    int t   = int(float(record.samples[i]) / float(maxVal) * 10.0f - 0.1f);
+    line[i] = char('0' + (t < 0 ? 0 : t));
+  }
+  puts(line);
+
+  // binary view against the global threshold, the adaptive mode of the car may differ locally
+  for (int i = 0; i < cCCDTelemetrySamples; i++) {
+    bool dark = i >= cCountStart && i <= cCountEnd && record.samples[i] < record.threshold;
+    line[i]   = dark ? 'x' : '-';
+  }
+  puts(line);
+
+  // one hot view of the track centre
+  memset(line, ' ', cCCDTelemetrySamples);
+  if (record.centreQ8 >= 0) {
+    int centre = (record.centreQ8 + 128) >> 8;
+    if (centre < cCCDTelemetrySamples)
+      line[centre] = '^';
+  }
+  puts(line);
+}
+
+void printCsvHeader() {
+  printf("seq,timestamp_ms,explosure_ms,status,threshold,centre,approaching");
+  for (int i = 0; i < cCCDTelemetrySamples; i++)
+    printf(",p%d", i);
+  printf("\n");
+}
+
+void printCsv(const ccdTelemetryRecord& record) {
+  printf("%u,%u,%u,%u,%u,", record.seq, record.timestampMs, record.explosureTime, record.status,
+         record.threshold);
+  if (record.centreQ8 >= 0)
+    printf("%.3f", record.centreQ8 / 256.0);
+  printf(",%d", (record.flags & cCCDTelemetryApproach) ? 1 : 0);
+  for (int i = 0; i < cCCDTelemetrySamples; i++)
+    printf(",%u", record.samples[i]);
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  bool csv         = false;
+  const char* path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--csv") == 0)
+      csv = true;
+    else
+      path = argv[i];
+  }
+
+  FILE* in = path ? fopen(path, "rb") : stdin;
+  if (!in) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+
+  std::vector<uint8_t> data;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+    data.insert(data.end(), chunk, chunk + n);
+  if (path)
+    fclose(in);
+
+  if (csv)
+    printCsvHeader();
+
+  // scan for the sync word, anything that does not check out (debug text printed to the same
+  // stream, a cut record) is skipped a byte at a time
+  unsigned long records = 0, skipped = 0, lost = 0;
+  uint32_t lastSeq = 0;
+  size_t pos       = 0;
+  while (pos + sizeof(ccdTelemetryRecord) <= data.size()) {
+    ccdTelemetryRecord record;
+    memcpy(&record, &data[pos], sizeof(record));
+    if (!ccdTelemetryValid(record)) {
+      pos++;
+      skipped++;
+      continue;
+    }
+
+    if (records > 0 && record.seq > lastSeq + 1)
+      lost += record.seq - lastSeq - 1;
+    lastSeq = record.seq;
+    records++;
+
+    if (csv)
+      printCsv(record);
+    else
+      printAscii(record);
+    pos += sizeof(record);
+  }
+
+  fprintf(stderr, "%lu records, %lu frames not streamed, %lu bytes skipped\n", records, lost,
+          skipped + (data.size() - pos));
+  return 0;
+}
@@ -0,0 +1,283 @@
+// host regression test of the ccd processing (dep/ccd.h) on fixed, synthetic frames: a dark line
+// on a light floor, a line too narrow to be the track, lines with their edges at fractions of a
+// pixel (under even and uneven lighting), a run over a platform bar, and the readout in the free
+// running sample stream of the dma capture backend at every phase to the clock. the stages
+// are checked on their own (threshold, black pixel count, track run, centre, segments), and the
+// whole of processCCD on a sequence of frames (status, track position, platform confirmation and
+// release). prints every failed check and exits with 1 if there was one
+//
+// build: see host/CMakeLists.txt, run by ctest
+// usage: ccdTest
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+
+#include "../dep/ccd.h"
+
+const int cTestLight = 200; // floor
+const int cTestDark  = 30;  // line and platform bars
+
+int testChecks   = 0;
+int testFailures = 0;
+
+void testCheck(bool ok, const char* format, ...) {
+  testChecks++;
+  if (ok)
+    return;
+  testFailures++;
+  va_list args;
+  va_start(args, format);
+  printf("FAILED: ");
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+// a frame of the floor with a dark stripe over [left, right], in pixels: pixel i sees the ground
+// from i - 0.5 to i + 0.5, a pixel the stripe only partly covers is mixed in proportion. the floor
+// loses the fraction gradient of its light from the first to the last pixel
+void makeStripeFrame(uint8_t* frame, float left, float right, float gradient = 0) {
+  for (int i = 0; i < cCCDFramePixels; i++) {
+    float light   = cTestLight * (1 - gradient * i / (cCCDFramePixels - 1));
+    float covered = min(right, i + 0.5f) - max(left, i - 0.5f);
+    clamp(covered, 0.0f, 1.0f);
+    frame[i] = uint8_t(lroundf(light - (light - cTestDark) * covered));
+  }
+}
+
+// the frames processCCD captures, through the replay hook of the host capture backend
+uint8_t testSourceFrame[cCCDFramePixels];
+void testSource(uint8_t* frame) { memcpy(frame, testSourceFrame, cCCDFramePixels); }
+
+// the processing state carried from frame to frame starts over
+void resetCCDState() {
+  roiSeedPixel         = -1;
+  roiMissCount         = 0;
+  lastAvailableAverage = 0;
+  lastTrackedThreshold = 0;
+  lastTrackedContrast  = 0;
+  platformWatch.reset();
+  platformGroundSpeed = 0;
+  platformLastFrameMs = 0;
+}
+
+// the stages of processCCD on one frame, in the order it runs them
+void testStages(const char* name, float left, float right, bool track) {
+  static uint8_t frame[cCCDFramePixels];
+  makeStripeFrame(frame, left, right);
+  resetCCDState();
+  linearData = frame;
+
+  int minVal, maxVal, avgVal;
+  parseLinearVals(minVal, maxVal, avgVal);
+  testCheck(minVal == cTestDark && maxVal == cTestLight, "%s: min %d, max %d", name, minVal,
+            maxVal);
+
+  int threshold = binarizeCCDFrame(minVal, maxVal);
+  testCheck(threshold > cTestDark && threshold <= cTestLight, "%s: threshold %d", name, threshold);
+
+  // the fully covered pixels are dark, the half covered ones at the ends of the stripe are not
+  int firstDark = int(ceilf(left + 0.5f)), lastDark = int(floorf(right - 0.5f));
+  int blackNum, whiteNum, totalNum;
+  parseBinaryVals(blackNum, whiteNum, totalNum);
+  testCheck(blackNum == lastDark - firstDark + 1, "%s: %d black pixels, expected %d", name,
+            blackNum, lastDark - firstDark + 1);
+
+  bool platformFrame;
+  detectPlatform(blackNum, totalNum, platformFrame);
+  testCheck(!platformFrame, "%s: taken for a platform", name);
+
+  int runLeft = -1, runRight = -1;
+  bool found = findTrackRun(runLeft, runRight);
+  testCheck(found == track, "%s: track %s", name, found ? "found" : "not found");
+  if (found && track) {
+    testCheck(runLeft == firstDark && runRight == lastDark, "%s: run %d - %d, expected %d - %d",
+              name, runLeft, runRight, firstDark, lastDark);
+
+    estimateTrackCentre(runLeft, runRight, threshold, maxVal - minVal, lastTrackEstimate);
+    float centre = float(lastTrackEstimate.centreQ8) / (1 << cSubPixelShift);
+    testCheck(fabsf(centre - (left + right) / 2) < 0.05f, "%s: centre %.3f, expected %.3f", name,
+              centre, (left + right) / 2);
+    testCheck(lastTrackEstimate.sharpness > cSharpnessMax / 2, "%s: sharpness %d", name,
+              lastTrackEstimate.sharpness);
+  }
+
+  // light, dark, light
+  ccdSegmentList segments;
+  extractSegments(segments);
+  testCheck(segments.count == 3 && !segments.overflow, "%s: %d segments", name, segments.count);
+  if (segments.count == 3) {
+    const ccdSegment& dark = segments.segments[1];
+    testCheck(segments.segments[0].start == cCountStart && segments.segments[2].end == cCountEnd,
+              "%s: segments do not cover the counting window", name);
+    testCheck(dark.dark && dark.start == firstDark && dark.end == lastDark,
+              "%s: dark segment %d - %d", name, dark.start, dark.end);
+    testCheck(dark.contrast > (cTestLight - cTestDark) * 3 / 4, "%s: contrast %d", name,
+              dark.contrast);
+  }
+}
+
+// the centre of a line whose edges fall anywhere inside a pixel: the partly covered edge pixels
+// have to move it by their share of the pixel. on an even floor and under a lighting gradient
+void testSubPixel(float gradient) {
+  static uint8_t frame[cCCDFramePixels];
+  float worst = 0;
+  for (int step = 0; step < 20; step++) {
+    float left = 50 + step * 0.55f, right = left + 12.3f;
+    makeStripeFrame(frame, left, right, gradient);
+    resetCCDState();
+    linearData = frame;
+
+    int minVal, maxVal, avgVal, runLeft, runRight;
+    parseLinearVals(minVal, maxVal, avgVal);
+    int threshold = binarizeCCDFrame(minVal, maxVal);
+    if (!findTrackRun(runLeft, runRight)) {
+      testCheck(false, "sub-pixel: line over %.2f - %.2f not found", left, right);
+      continue;
+    }
+    estimateTrackCentre(runLeft, runRight, threshold, maxVal - minVal, lastTrackEstimate);
+    float centre = float(lastTrackEstimate.centreQ8) / (1 << cSubPixelShift);
+    worst        = max(worst, fabsf(centre - (left + right) / 2));
+  }
+  testCheck(worst < 0.05f, "sub-pixel, gradient %.2f: centre off by up to %.3f pixel", gradient,
+            worst);
+}
+
+// the i2s adc stream of the dma backend (dep/ccdCapture.h) with a frame in it: lead samples of the
+// idle level, then the 129 clocks of the readout at cCCDOversample samples each, then idle again.
+// the sample a clock edge falls in mixes the two pixels by some share, every sample is noisy by up
+// to half a step of the frame's 8 bits. stored with the halves of every 32 bit word swapped
+void makeSampleStream(uint16_t* samples, const uint8_t* frame, int lead) {
+  const int idle = 100;
+  uint32_t noise = 12345 + lead;
+  int mixed      = (lead * 37) % 100; // percent of the new pixel in the edge sample
+  for (int k = 0; k < cCCDSampleCount; k++) {
+    int j = k - lead, pixel = j / cCCDOversample, value = idle;
+    if (j >= 0 && pixel < cCCDFramePixels) {
+      value = (frame[pixel] << cCCDI2SAdcShift) + (1 << (cCCDI2SAdcShift - 1));
+      if (j % cCCDOversample == 0) {
+        int before = pixel ? (frame[pixel - 1] << cCCDI2SAdcShift) : idle;
+        value      = (value * mixed + before * (100 - mixed)) / 100;
+      }
+    }
+    noise = noise * 1103515245u + 12345;
+    value += int(noise >> 16) % ((1 << (cCCDI2SAdcShift - 1)) - 1);
+    samples[k ^ 1] = uint16_t(value);
+  }
+}
+
+// the frame comes out of the stream whatever the lead, a whole number of clocks or not
+void testSampleStream() {
+  static uint8_t frame[cCCDFramePixels], read[cCCDFramePixels];
+  static uint16_t samples[cCCDSampleCount];
+  makeStripeFrame(frame, 52.3f, 66.8f, 0.3f);
+
+  int wrong = 0;
+  for (int lead = 0; lead < cCCDLeadCycles * cCCDOversample; lead++) {
+    makeSampleStream(samples, frame, lead);
+    ccdFrameFromStream(samples, ccdFindReadoutStart(samples, cCCDSampleCount), read);
+    if (memcmp(frame, read, cCCDFramePixels) == 0)
+      continue;
+    if (!wrong++)
+      testCheck(false, "sample stream: frame not read out after %d lead samples", lead);
+  }
+  testCheck(wrong == 0, "sample stream: %d of %d leads read out wrong", wrong,
+            cCCDLeadCycles * cCCDOversample);
+}
+
+// processCCD on a frame with the stripe, returns the status
+int testProcess(float left, float right, float& trackMidPixel) {
+  makeStripeFrame(testSourceFrame, left, right);
+  int status;
+  processCCD(trackMidPixel, status, cDefaultExplosureTime);
+  return status;
+}
+
+// the raw pixel position processCCD maps to its 0 - 128 output
+float testMapped(float pixel) {
+  return (pixel - cCountStart) * 128.0f / (cCountEnd - cCountStart);
+}
+
+// a line moving across, onto a platform bar and off it again
+void testSequence() {
+  resetCCDState();
+  ccdReplaySource = testSource;
+
+  float trackMidPixel = -1;
+  for (float centre = 40; centre <= 100; centre += 7.5f) {
+    int status = testProcess(centre - 6, centre + 6, trackMidPixel);
+    testCheck(status == STATUS_NORMAL, "sequence: line at %.1f, status %d", centre, status);
+    testCheck(fabsf(trackMidPixel - testMapped(centre)) < 0.05f,
+              "sequence: line at %.1f, track at %.3f, expected %.3f", centre, trackMidPixel,
+              testMapped(centre));
+  }
+
+  // a single bar frame is not trusted, the platform is confirmed by the third one
+  for (int frame = 0; frame < cPlatformConfirmHits; frame++) {
+    int status   = testProcess(10, 120, trackMidPixel);
+    int expected = (frame + 1 < cPlatformConfirmHits) ? STATUS_NO_TRACK : STATUS_PLATFORM;
+    testCheck(status == expected, "sequence: bar frame %d, status %d, expected %d", frame, status,
+              expected);
+  }
+
+  // released once a whole window of frames is off the bar
+  for (int frame = 0; frame < cPlatformConfirmWindow; frame++) {
+    int status   = testProcess(58, 70, trackMidPixel);
+    int expected = (frame + 1 < cPlatformConfirmWindow) ? STATUS_PLATFORM : STATUS_NORMAL;
+    testCheck(status == expected, "sequence: frame %d after the bar, status %d, expected %d", frame,
+              status, expected);
+  }
+  testCheck(fabsf(trackMidPixel - testMapped(64)) < 0.05f, "sequence: track at %.3f after the bar",
+            trackMidPixel);
+
+  ccdReplaySource = nullptr;
+}
+
+// the car driving over a 0.15 m bar at speed (m / s) with a frame every periodMs: the bar is under
+// the sensor for fewer frames than the detector counts on at a standstill, it is still confirmed
+void testPlatformAtSpeed(float speed, int periodMs) {
+  resetCCDState();
+  ccdReplaySource     = testSource;
+  platformGroundSpeed = speed * encoder_ticks_per_m / 1000;
+
+  const float barStart = 1.0f, barEnd = 1.15f;
+  float trackMidPixel  = -1;
+  uint64_t startUs     = micros();
+  int barFrames = 0, platformFrames = 0, earlyFrames = 0;
+  for (int frame = 0;; frame++) {
+    float at = speed * frame * periodMs / 1000;
+    if (at > barEnd + 0.1f)
+      break;
+    // the frames are a period apart, the explosure the capture waits is shorter
+    halAdvanceToUs(startUs + uint64_t(frame) * periodMs * 1000);
+    bool onBar = at >= barStart && at <= barEnd;
+    int status = onBar ? testProcess(10, 120, trackMidPixel) : testProcess(58, 70, trackMidPixel);
+    barFrames += onBar;
+    platformFrames += status == STATUS_PLATFORM;
+    earlyFrames += status == STATUS_PLATFORM && at < barStart;
+  }
+  testCheck(platformFrames > 0 && earlyFrames == 0,
+            "bar at %.2f m/s, %d ms frames: seen in %d frames, %d platform frames, %d before it",
+            speed, periodMs, barFrames, platformFrames, earlyFrames);
+
+  ccdReplaySource = nullptr;
+}
+
+int main() {
+  Serial.setOutput(nullptr);
+  halClockSimulatedFrom(0);
+
+  testStages("line on pixels 60 - 71", 59.5f, 71.5f, true);
+  testStages("line on pixels 30 - 41", 29.5f, 41.5f, true);
+  testStages("line too narrow", 59.5f, 65.5f, false);
+  testSubPixel(0);
+  testSubPixel(0.4f);
+  testSampleStream();
+  testSequence();
+  for (float speed : {0.3f, 0.6f, 0.8f, 1.0f, 1.2f})
+    testPlatformAtSpeed(speed, 77);
+
+  printf("ccd: %d checks, %d failed\n", testChecks, testFailures);
+  return testFailures ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+// host stress test and benchmark of the lock-free channels (dep/channel.h). the stress test runs
+// the sides of every channel in their own threads for a while and checks what arrives: a ring must
+// deliver every value once and in order, through push / pop as well as claim / commit and peek /
+// release, and a seqlock cell must only ever hand out whole values of its writer, in the order they
+// were written. the benchmark reports the cost of every operation on one thread, and the throughput
+// of a ring and the read rate of a cell with the sides on different threads
+//
+// the threads are not pinned, the scheduler moves them between cores. a failed check exits with 1,
+// build with HOST_SANITIZE for the address and undefined behaviour sanitizers
+//
+// build: see host/CMakeLists.txt, or g++ -std=gnu++17 -O2 -pthread -o channelBench
+//        host/channelBench.cpp
+// usage: channelBench [values]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../dep/channel.h"
+
+const int cBenchReaders = 3; // readers of the seqlock cell next to its writer
+
+volatile uint32_t benchSink = 0;
+bool benchFailed            = false;
+
+double benchSeconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void benchCheck(bool ok, const char* what, unsigned long at) {
+  if (ok || benchFailed)
+    return;
+  printf("FAILED: %s at %lu\n", what, at);
+  benchFailed = true;
+}
+
+// a side that has to wait for the other gives up its core, on a machine with fewer cores than
+// threads the other side would not run until the end of the time slice otherwise
+int benchYield() {
+  std::this_thread::yield();
+  return 1;
+}
+
+// a value that carries a check of itself, a torn or stale copy does not pass
+struct benchValue {
+  uint32_t seq;
+  uint32_t words[7];
+};
+
+void benchFill(benchValue& value, uint32_t seq) {
+  value.seq = seq;
+  for (int i = 0; i < 7; i++)
+    value.words[i] = seq * 2654435761u + i;
+}
+
+bool benchWhole(const benchValue& value) {
+  for (int i = 0; i < 7; i++)
+    if (value.words[i] != value.seq * 2654435761u + i)
+      return false;
+  return true;
+}
+
+// the producer pushes count values through a ring, the consumer pops and checks them. inPlace
+// writes and reads them in their slots instead of copying. returns the values per second
+template <uint32_t N> double stressRing(const char* name, unsigned long count, bool inPlace) {
+  static spscRing<benchValue, N> ring;
+  std::atomic<unsigned long> full{0};
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([&] {
+    unsigned long waits = 0;
+    for (uint32_t seq = 0; seq < count; seq++) {
+      if (inPlace) {
+        benchValue* slot;
+        while (!(slot = ring.claim()))
+          waits += benchYield();
+        benchFill(*slot, seq);
+        ring.commit();
+      } else {
+        benchValue value;
+        benchFill(value, seq);
+        while (!ring.push(value))
+          waits += benchYield();
+      }
+    }
+    full = waits;
+  });
+
+  unsigned long empty = 0;
+  for (uint32_t seq = 0; seq < count; seq++) {
+    if (inPlace) {
+      const benchValue* slot;
+      while (!(slot = ring.peek()))
+        empty += benchYield();
+      benchCheck(slot->seq == seq && benchWhole(*slot), "ring value lost, torn or reordered", seq);
+      ring.release();
+    } else {
+      benchValue value;
+      while (!ring.pop(value))
+        empty += benchYield();
+      benchCheck(value.seq == seq && benchWhole(value), "ring value lost, torn or reordered", seq);
+    }
+  }
+  producer.join();
+  double seconds = benchSeconds(start);
+
+  benchCheck(ring.empty(), "ring not empty at the end", count);
+  printf("%-34s %10.1f M/s %12lu %12lu\n", name, count / seconds * 1e-6, full.load(), empty);
+  return count / seconds;
+}
+
+// the writer writes count values into a cell, the readers read it until the writer is done and
+// check that every value is whole and none is older than the one before
+void stressSeqlock(unsigned long count) {
+  static seqlockCell<benchValue> cell;
+  std::atomic<bool> writing{true};
+  std::atomic<unsigned long> reads{0}, retries{0}, fresh{0};
+
+  // the cell holds a valid value before the readers start
+  benchValue value;
+  benchFill(value, 0);
+  cell.write(value);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> readers;
+  for (int r = 0; r < cBenchReaders; r++) {
+    readers.emplace_back([&] {
+      unsigned long myReads = 0, myRetries = 0, myFresh = 0;
+      uint32_t last = 0;
+      benchValue value;
+      while (writing) {
+        if (!cell.tryRead(value)) {
+          myRetries += benchYield();
+          continue;
+        }
+        myReads++;
+        benchCheck(benchWhole(value), "seqlock value torn", value.seq);
+        benchCheck(value.seq >= last, "seqlock value older than the one before", value.seq);
+        myFresh += value.seq != last;
+        last = value.seq;
+      }
+      reads += myReads;
+      retries += myRetries;
+      fresh += myFresh;
+    });
+  }
+
+  for (uint32_t seq = 1; seq <= count; seq++) {
+    benchFill(value, seq);
+    cell.write(value);
+  }
+  writing = false;
+  for (auto& reader : readers)
+    reader.join();
+  double seconds = benchSeconds(start);
+
+  benchCheck(cell.read().seq == count && cell.writes() == count + 1, "seqlock last value", count);
+  printf("seqlock: %d readers, %.1f M writes / s, %.1f M reads / s, %.1f %% retries, "
+         "%.1f %% of the reads new\n",
+         cBenchReaders, count / seconds * 1e-6, reads / seconds * 1e-6,
+         100.0 * retries / max(1ul, reads + retries), 100.0 * fresh / max(1ul, reads.load()));
+}
+
+// ns per call of body on a single thread
+template <class F> void benchSingle(const char* name, unsigned long iterations, F body) {
+  for (unsigned long i = 0; i < iterations / 10; i++)
+    body(i);
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < iterations; i++)
+    body(i);
+  printf("%-34s %10.1f ns\n", name, benchSeconds(start) * 1e9 / iterations);
+}
+
+int main(int argc, char** argv) {
+  unsigned long values = (argc > 1) ? atol(argv[1]) : 10000000;
+
+  printf("%lu values, %u hardware threads\n\n", values, std::thread::hardware_concurrency());
+
+  printf("single thread\n");
+  static spscRing<uint32_t, 128> edges;
+  benchSingle("  ring<uint32_t> push + pop", values, [](unsigned long i) {
+    uint32_t value = 0;
+    bool passed    = edges.push(uint32_t(i)) && edges.pop(value);
+    benchCheck(passed && value == uint32_t(i), "ring push + pop on a single thread", i);
+    benchSink = value;
+  });
+  static spscRing<benchValue, 8> records;
+  benchSingle("  ring<32 bytes> claim + peek", values, [](unsigned long i) {
+    benchFill(*records.claim(), uint32_t(i));
+    records.commit();
+    benchSink = records.peek()->seq;
+    records.release();
+  });
+  static seqlockCell<benchValue> cell;
+  benchSingle("  seqlock<32 bytes> write", values, [](unsigned long i) {
+    benchValue value;
+    benchFill(value, uint32_t(i));
+    cell.write(value);
+  });
+  benchSingle("  seqlock<32 bytes> read", values,
+              [](unsigned long) { benchSink = cell.read().seq; });
+
+  printf("\n%-34s %14s %12s %12s\n", "ring, producer and consumer thread", "throughput",
+         "full waits", "empty waits");
+  stressRing<4>("  4 slots, push / pop", values, false);
+  stressRing<128>("  128 slots, push / pop", values, false);
+  stressRing<8>("  8 slots, claim / peek", values, true);
+  stressRing<1024>("  1024 slots, claim / peek", values, true);
+
+  printf("\n");
+  stressSeqlock(values);
+
+  printf("\n%s\n", benchFailed ? "FAILED" : "all channel checks passed");
+  return benchFailed ? 1 : 0;
+}
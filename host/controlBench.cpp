@@ -0,0 +1,817 @@
+// host benchmark of the control stack: the ccd processing stages, the track filter, the platform
+// detector, pid, speed planner, colour classification, bt_data encoding and command parsing. every
+// stage reports ns per call and heap allocations per call, the firmware is expected to stay at 0
+// allocations
+//
+// the packed binary line is compared with the bool per pixel one it replaced: the results have to
+// be identical on the same frames, and the time of either is reported. otsu and the adaptive
+// threshold are timed against the min / max midpoint, and the adaptive one has to binarize frames
+// under uneven lighting right. the frame path on int samples is compared with the uint8_t one the
+// same way, in cycles per frame. the golden-section search of the explosure has to settle where the
+// sweep it replaced does, with fewer captures
+//
+// the pid is also compared with the one of the firmware before it ran on measured time: the step
+// response of a first order plant to a setpoint and a load step, with a jittering control period,
+// and with a saturating plant input. the controllers on measured time have to keep every scenario
+// within its bounds of overshoot, settling time and final error, a failed check exits with 1
+//
+// build: see host/CMakeLists.txt, or g++ -std=gnu++17 -O2 -pthread -o controlBench
+//        host/controlBench.cpp
+// usage: controlBench [iterations]
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../dep/ccd.h"
+#include "../dep/color.h"
+#include "../dep/commandParser.h"
+#include "../dep/data.h"
+#include "../dep/motor.h"
+#include "../dep/pid.h"
+#include "../dep/platformDetector.h"
+#include "../dep/speedPlanner.h"
+#include "../dep/trackFilter.h"
+
+// every heap allocation of the process is counted
+std::atomic<unsigned long> benchAllocations{0};
+
+void* operator new(size_t size) {
+  benchAllocations++;
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+const int cBenchFrames = 64;
+
+alignas(4) uint8_t benchFrames[cBenchFrames][cNumPixels];
+volatile int benchSink = 0;
+bool benchFailed       = false;
+
+void benchCheck(bool ok, const char* what, long at) {
+  if (ok || benchFailed)
+    return;
+  printf("FAILED: %s at %ld\n", what, at);
+  benchFailed = true;
+}
+
+// xorshift, the frames are the same on every run
+uint32_t benchRandomState = 0x12345678;
+uint32_t benchRandom() {
+  benchRandomState ^= benchRandomState << 13;
+  benchRandomState ^= benchRandomState >> 17;
+  benchRandomState ^= benchRandomState << 5;
+  return benchRandomState;
+}
+
+// a dark line of 10 - 16 pixels on a bright, slightly vignetted and noisy background. every 16th
+// frame is a platform bar
+void makeFrames() {
+  for (int f = 0; f < cBenchFrames; f++) {
+    int centre = 30 + int(benchRandom() % 70);
+    int half   = 5 + int(benchRandom() % 4);
+    bool bar   = f % 16 == 15;
+    for (int i = 0; i < cNumPixels; i++) {
+      int edge  = abs(i - 64) / 4;
+      int light = 210 - edge + int(benchRandom() % 16) - 8;
+      int dark  = 35 + int(benchRandom() % 10);
+      bool line = bar ? (i > 20 && i < 120) : abs(i - centre) <= half;
+
+      benchFrames[f][i] = line ? dark : light;
+    }
+  }
+}
+
+struct benchResult {
+  double nsPerCall;
+  double allocsPerCall;
+};
+
+template <class F> benchResult bench(const char* name, long iterations, F body) {
+  for (long i = 0; i < iterations / 10; i++)
+    body(i);
+
+  unsigned long allocsBefore = benchAllocations;
+  auto start                 = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++)
+    body(i);
+  auto end = std::chrono::steady_clock::now();
+
+  benchResult result;
+  double elapsedNs     = std::chrono::duration<double, std::nano>(end - start).count();
+  result.nsPerCall     = elapsedNs / iterations;
+  result.allocsPerCall = double(benchAllocations - allocsBefore) / iterations;
+  printf("%-34s %10.1f ns %10.3f allocs\n", name, result.nsPerCall, result.allocsPerCall);
+  return result;
+}
+
+// the ccd stages of processCCD without the capture, run as growing prefixes so the cost of every
+// stage is the difference to the previous prefix
+int runCCDStages(long i, int stages) {
+  linearData = benchFrames[i % cBenchFrames];
+
+  int minVal, maxVal, avgVal;
+  parseLinearVals(minVal, maxVal, avgVal);
+  if (stages == 1)
+    return maxVal;
+
+  int threshold = binarizeCCDFrame(minVal, maxVal);
+  int blackNum, whiteNum, totalNum;
+  parseBinaryVals(blackNum, whiteNum, totalNum);
+  if (stages == 2)
+    return blackNum + threshold;
+
+  bool platformFrame;
+  detectPlatform(blackNum, totalNum, platformFrame);
+  if (stages == 3)
+    return platformFrame;
+
+  int left, right;
+  if (findTrackRun(left, right))
+    estimateTrackCentre(left, right, threshold, maxVal - minVal, lastTrackEstimate);
+  if (stages == 4)
+    return lastTrackEstimate.centreQ8;
+
+  ccdSegmentList segments;
+  extractSegments(segments);
+  return segments.count;
+}
+
+// the binary line of the firmware before it was packed into 128 bits: a bool per pixel, counted,
+// searched and split into runs a pixel at a time
+bool legacyBinary[cNumPixels];
+
+void legacyLinearToBinary(int threshold) {
+  memset(legacyBinary, 0, sizeof(legacyBinary));
+  for (int i = cCountStart; i <= cCountEnd; i++)
+    legacyBinary[i] = (linearData[i] < threshold) ? true : false;
+}
+
+int legacyBlackNum() {
+  int blackNum = 0;
+  for (int i = cCountStart; i <= cCountEnd; i++)
+    if (legacyBinary[i])
+      blackNum++;
+  return blackNum;
+}
+
+// the first dark run at or after from at least cEffectiveLineWidthMin wide
+bool legacyTrackRun(int from, int& left, int& right) {
+  int dark = 0;
+  for (int i = from; i <= cCountEnd; i++) {
+    if (legacyBinary[i]) {
+      dark++;
+      continue;
+    }
+    if (dark >= cEffectiveLineWidthMin) {
+      left  = i - dark;
+      right = i - 1;
+      return true;
+    }
+    dark = 0;
+  }
+  left  = cCountEnd + 1 - dark;
+  right = cCountEnd;
+  return dark >= cEffectiveLineWidthMin;
+}
+
+// the pixels that differ from the one before them, returns their number
+int legacyEdges(int* edges) {
+  int count = 0;
+  for (int i = cCountStart + 1; i <= cCountEnd; i++)
+    if (legacyBinary[i] != legacyBinary[i - 1])
+      edges[count++] = i;
+  return count;
+}
+
+// the same on the packed line, a run at a time
+int packedEdges(int* edges) {
+  int count = 0, pos = cCountStart;
+  bool dark = binaryLineGet(binaryData, pos);
+  while ((pos = binaryLineNext(binaryData, pos, !dark)) <= cCountEnd) {
+    edges[count++] = pos;
+    dark           = !dark;
+  }
+  return count;
+}
+
+// the middle pixel of a run as getTrackMidPixel() takes it, the darker one of an even run
+int runMidPixel(int left, int right) {
+  int mid = (left + right) / 2;
+  if ((right - left) % 2 == 1 && linearData[mid + 1] <= linearData[mid])
+    mid++;
+  return mid;
+}
+
+// binarize, count, and the first run and its centre, both ways. returns a mix of the results
+int legacyBinaryStages(long i, int threshold) {
+  linearData = benchFrames[i % cBenchFrames];
+  legacyLinearToBinary(threshold);
+  int left = -1, right = -1;
+  bool found = legacyTrackRun(cCountStart, left, right);
+  return legacyBlackNum() + (found ? runMidPixel(left, right) : -1);
+}
+
+int packedBinaryStages(long i, int threshold) {
+  linearData = benchFrames[i % cBenchFrames];
+  linearToBinary(0, 0, threshold);
+  int blackNum, whiteNum, totalNum;
+  parseBinaryVals(blackNum, whiteNum, totalNum);
+  return blackNum + getTrackMidPixel();
+}
+
+// the packed binary line against the byte per pixel one on the same frames: every frame at every
+// threshold from below the darkest pixel to above the brightest one has to give the same dark
+// pixels, edges, runs and run centres. the time is the one of the work of a frame: binarize,
+// count, first run and its centre
+void compareBinaryLines(long iterations) {
+  printf("\nbinary line, packed into 128 bits against a bool per pixel\n");
+
+  bool failedBefore = benchFailed;
+  long compared     = 0;
+  for (int f = 0; f < cBenchFrames; f++) {
+    for (int threshold = -5; threshold <= 260; threshold += 5, compared++) {
+      linearData = benchFrames[f];
+      legacyLinearToBinary(threshold);
+      linearToBinary(0, 0, threshold);
+
+      int blackNum, whiteNum, totalNum;
+      parseBinaryVals(blackNum, whiteNum, totalNum);
+      bool same = blackNum == legacyBlackNum();
+      for (int i = 0; i < cNumPixels; i++)
+        same &= binaryLineGet(binaryData, i) == legacyBinary[i];
+      benchCheck(same, "packed line differs from the bool per pixel one", compared);
+
+      int edges[cNumPixels], legacy[cNumPixels];
+      int count = packedEdges(edges);
+      same      = count == legacyEdges(legacy);
+      for (int e = 0; same && e < count; e++)
+        same = edges[e] == legacy[e];
+      benchCheck(same, "packed line edges differ", compared);
+
+      // every run wide enough to be the track, from the left
+      int from = cCountStart, left, right, legacyLeft, legacyRight;
+      while (true) {
+        bool found = binaryLineFindRun(binaryData, from, cCountEnd, cEffectiveLineWidthMin, left,
+                                       right);
+        bool legacyFound = legacyTrackRun(from, legacyLeft, legacyRight);
+        benchCheck(found == legacyFound && (!found || (left == legacyLeft && right == legacyRight)),
+                   "packed line runs differ", compared);
+        if (!found || !legacyFound)
+          break;
+        from = right + 1;
+      }
+
+      int centre = legacyTrackRun(cCountStart, legacyLeft, legacyRight)
+                       ? runMidPixel(legacyLeft, legacyRight)
+                       : -1;
+      benchCheck(getTrackMidPixel() == centre, "packed line track centre differs", compared);
+    }
+  }
+  printf("  %ld frames and thresholds, dark pixels, edges, runs and centres %s\n", compared,
+         (benchFailed && !failedBefore) ? "differ" : "identical");
+
+  benchResult legacy = bench("  bool per pixel", iterations,
+                             [](long i) { benchSink = legacyBinaryStages(i, 120); });
+  benchResult packed = bench("  packed 128 bit", iterations,
+                             [](long i) { benchSink = packedBinaryStages(i, 120); });
+  printf("  %.1fx the speed\n", legacy.nsPerCall / packed.nsPerCall);
+}
+
+// frames under uneven lighting: the floor falls from full light at one end to a third of it at
+// the other (a shadow across the line), the line reflects a fifth of the light falling on it, and
+// half of the frames have a specular hot pixel. the line of frame f covers [unevenLeft[f],
+// unevenLeft[f] + 13]
+const int cUnevenFrames = 32;
+
+alignas(4) uint8_t unevenFrames[cUnevenFrames][cNumPixels];
+int unevenLeft[cUnevenFrames];
+
+void makeUnevenFrames() {
+  for (int f = 0; f < cUnevenFrames; f++) {
+    bool falling  = f % 2 == 0;
+    unevenLeft[f] = 20 + int(benchRandom() % 80);
+    int hot       = (f % 4 < 2) ? 10 + int(benchRandom() % 100) : -1;
+    if (hot >= unevenLeft[f] - 1 && hot <= unevenLeft[f] + 14)
+      hot = unevenLeft[f] + 16; // on the floor next to the line
+    for (int i = 0; i < cNumPixels; i++) {
+      float along = float(falling ? i : cNumPixels - 1 - i) / (cNumPixels - 1);
+      float light = 230 * (1 - 0.65f * along) + int(benchRandom() % 12) - 6;
+      bool line   = i >= unevenLeft[f] && i <= unevenLeft[f] + 13;
+      unevenFrames[f][i] = (i == hot) ? 255 : uint8_t(line ? light / 5 : light);
+    }
+  }
+}
+
+const int cThresholdMethods = 3;
+const char* thresholdMethodNames[cThresholdMethods] = {"min / max midpoint", "otsu",
+                                                       "otsu + adaptive"};
+
+// the stages up to the binary line with a threshold method, returns the threshold
+int binarizeWith(int method, uint8_t* frame) {
+  linearData = frame;
+  int minVal, maxVal, avgVal;
+  parseLinearVals(minVal, maxVal, avgVal);
+  if (method == 0)
+    return linearToBinary(minVal, maxVal);
+
+  int threshold = otsuThreshold(minVal, maxVal);
+  if (method == 1)
+    return linearToBinary(minVal, maxVal, threshold);
+  linearToBinaryAdaptive(minVal, maxVal, threshold);
+  return threshold;
+}
+
+// otsu and the adaptive threshold against the min / max midpoint they replaced: the cost of each
+// on the bench frames, and what they make of the frames under uneven lighting. the midpoint is the
+// reference, otsu + adaptive (the firmware's mode for gradients) has to find the line on every one
+// of them and classify every pixel but the ones at its edges right
+void compareThresholds(long iterations) {
+  printf("\nbinarization: cost, and wrong pixels and lines found under uneven lighting (%d "
+         "frames)\n",
+         cUnevenFrames);
+
+  makeUnevenFrames();
+  for (int method = 0; method < cThresholdMethods; method++) {
+    int wrong = 0, found = 0;
+    for (int f = 0; f < cUnevenFrames; f++) {
+      binarizeWith(method, unevenFrames[f]);
+      for (int i = cCountStart; i <= cCountEnd; i++) {
+        bool line = i >= unevenLeft[f] && i <= unevenLeft[f] + 13;
+        wrong += binaryLineGet(binaryData, i) != line;
+      }
+      int left, right;
+      found += getTrackRun(left, right) && left == unevenLeft[f] && right == unevenLeft[f] + 13;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "  %s", thresholdMethodNames[method]);
+    bench(name, iterations, [method](long i) {
+      benchSink = binarizeWith(method, benchFrames[i % cBenchFrames]);
+    });
+    printf("    %d wrong pixels, line found in %d / %d\n", wrong, found, cUnevenFrames);
+    if (method == 2)
+      benchCheck(found == cUnevenFrames && wrong == 0, "adaptive threshold under uneven lighting",
+                 wrong);
+  }
+}
+
+// the time stamp counter where there is one (x86, counts at a fixed rate near the core clock), ns
+// otherwise
+#if defined(__x86_64__) || defined(__i386__)
+const char* cBenchCycleUnit = "tsc cycles";
+uint64_t benchCycles() { return __rdtsc(); }
+#else
+const char* cBenchCycleUnit = "ns";
+uint64_t benchCycles() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+#endif
+
+// the two stages that read the samples, as the firmware had them before its frames were narrowed
+// from int to uint8_t: the statistics and the histogram, and the compare-and-pack, on the 12-bit
+// samples of the adc. the histogram has the same 64 bins at either width and the rest of the frame
+// path works on the histogram and the packed line only, so it is shared
+const int cLegacyAdcMax            = 4095;
+const int cLegacyHistogramBinWidth = (cLegacyAdcMax + 1) / cLinearHistogramBins;
+const int cLegacySampleShift       = 4; // 12 - 8 bits
+int legacyFrames[cBenchFrames][cNumPixels];
+
+void legacyParseLinearVals(const int* linear, int& minVal, int& maxVal, int& avgVal) {
+  maxVal = 0;
+  minVal = 1e6;
+  memset(linearHistogram, 0, sizeof(linearHistogram));
+
+  for (int i = cCountStart; i <= cCountEnd; i++) {
+    int currentVal = linear[i];
+
+    if (maxVal < currentVal)
+      maxVal = currentVal;
+    if (minVal > currentVal)
+      minVal = currentVal;
+
+    linearHistogram[min(currentVal, cLegacyAdcMax) / cLegacyHistogramBinWidth]++;
+  }
+  avgVal = customRound(float(minVal + maxVal) / 2.0f);
+}
+
+void legacyBinaryLinePack(const int* linear, int threshold, int start, int end, binaryLine& line) {
+  binaryLineClear(line);
+
+  for (int i = start; i <= end; i++) {
+    uint32_t bit = uint32_t(linear[i] - threshold) >> 31;
+    line.words[i >> 5] |= bit << (i & 31);
+  }
+}
+
+// the frame path up to the track run: statistics, otsu, binarize, count, first run
+struct frameStagesResult {
+  int minVal, maxVal, threshold, blackNum, left, right;
+};
+
+frameStagesResult legacyFrameStages(const int* frame) {
+  frameStagesResult r{0, 0, 0, 0, -1, -1};
+  int avgVal, whiteNum, totalNum;
+  legacyParseLinearVals(frame, r.minVal, r.maxVal, avgVal);
+  r.threshold = otsuThreshold(r.minVal >> cLegacySampleShift, r.maxVal >> cLegacySampleShift)
+                << cLegacySampleShift;
+  legacyBinaryLinePack(frame, r.threshold, cCountStart, cCountEnd, binaryData);
+  parseBinaryVals(r.blackNum, whiteNum, totalNum);
+  getTrackRun(r.left, r.right);
+  return r;
+}
+
+frameStagesResult firmwareFrameStages(uint8_t* frame) {
+  frameStagesResult r{0, 0, 0, 0, -1, -1};
+  int avgVal, whiteNum, totalNum;
+  linearData = frame;
+  parseLinearVals(r.minVal, r.maxVal, avgVal);
+  r.threshold = linearToBinary(r.minVal, r.maxVal, otsuThreshold(r.minVal, r.maxVal));
+  parseBinaryVals(r.blackNum, whiteNum, totalNum);
+  getTrackRun(r.left, r.right);
+  return r;
+}
+
+// cycles per call of body, the mean of the fastest of 5 rounds
+template <class F> double cyclesPerCall(long iterations, F body) {
+  double best = 1e30;
+  for (int round = 0; round < 5; round++) {
+    uint64_t start = benchCycles();
+    for (long i = 0; i < iterations / 5; i++)
+      body(i);
+    best = min(best, double(benchCycles() - start) / (iterations / 5));
+  }
+  return best;
+}
+
+// the frame path of the firmware on its uint8_t frames against the int one it replaced, on the same
+// frames read out at 12 bits: both have to find the same statistics, threshold, dark pixels and
+// run. the size of a frame and the cycles of the path are reported, not asserted. on a host both
+// frame sets sit in the first level cache, the byte loads save nothing by themselves: what the
+// uint8_t path gains comes from binaryLinePack comparing four pixels per step
+void compareSampleWidths(long iterations) {
+  printf("\nframe samples, int against uint8_t (%s per frame)\n", cBenchCycleUnit);
+
+  for (int f = 0; f < cBenchFrames; f++)
+    for (int i = 0; i < cNumPixels; i++)
+      legacyFrames[f][i] = benchFrames[f][i] << cLegacySampleShift;
+
+  for (int f = 0; f < cBenchFrames; f++) {
+    frameStagesResult wide   = legacyFrameStages(legacyFrames[f]);
+    frameStagesResult narrow = firmwareFrameStages(benchFrames[f]);
+    benchCheck(wide.minVal == narrow.minVal << cLegacySampleShift &&
+                   wide.maxVal == narrow.maxVal << cLegacySampleShift &&
+                   wide.threshold == narrow.threshold << cLegacySampleShift &&
+                   wide.blackNum == narrow.blackNum && wide.left == narrow.left &&
+                   wide.right == narrow.right,
+               "the uint8_t frame path differs from the int one", f);
+  }
+
+  double wide = cyclesPerCall(iterations, [](long i) {
+    benchSink = benchSink + legacyFrameStages(legacyFrames[i % cBenchFrames]).blackNum;
+  });
+  double narrow = cyclesPerCall(iterations, [](long i) {
+    benchSink = benchSink + firmwareFrameStages(benchFrames[i % cBenchFrames]).blackNum;
+  });
+  printf("  int:     %4zu bytes / frame %10.0f\n", sizeof(legacyFrames[0]), wide);
+  printf("  uint8_t: %4zu bytes / frame %10.0f  (%.2fx the cycles)\n", sizeof(ccdFrame::linear),
+         narrow, narrow / wide);
+}
+
+// the sensor for the explosure calibration: a dark line on a vignetted floor, every pixel grows
+// with the time integrated since the previous capture until it saturates. the contrast (min / max)
+// of the frame falls with the explosure until the brightest pixel saturates and rises after, the
+// best explosure is the one that just saturates it, at optimumMs. an optimum of 0 is a flat frame
+// without a line
+const int cExplosureCurves                       = 6;
+const float explosureOptimumMs[cExplosureCurves] = {50, 72, 95, 118, 150, 0};
+float explosureSensorOptimumMs                   = 0;
+unsigned long explosureSensorLastUs              = 0;
+
+void explosureSensor(uint8_t* frame) {
+  float integratedMs    = (micros() - explosureSensorLastUs) / 1000.0f;
+  explosureSensorLastUs = micros();
+  for (int i = 0; i < cNumPixels; i++) {
+    float light = 235 / explosureSensorOptimumMs * (1 - 0.2f * abs(i - 64) / 64) * integratedMs;
+    if (abs(i - 64) <= 6)
+      light *= 0.05f;
+    frame[i] = (explosureSensorOptimumMs > 0) ? uint8_t(lroundf(min(20 + light, 255.0f))) : 128;
+  }
+}
+
+// the golden-section search of the explosure against the sweep it replaced, on the virtual clock:
+// the captures and the time each takes, and the explosure it settles on. the search has to settle
+// on the sweep's explosure on every curve, with fewer captures
+void compareExplosureSearch() {
+  printf("\nexplosure calibration, golden-section search against the sweep\n");
+  printf("  %-12s %23s %23s\n", "optimum", "sweep", "search");
+
+  halClockSimulatedFrom(0);
+  ccdReplaySource = explosureSensor;
+  for (int curve = 0; curve < cExplosureCurves; curve++) {
+    explosureSensorOptimumMs = explosureOptimumMs[curve];
+
+    explosureRecord best[2];
+    bool blocked[2];
+    unsigned long captures[2], durationMs[2];
+    for (int search = 0; search < 2; search++) {
+      unsigned long startCaptures = ccdCaptureCount, startMs = millis();
+      if (search)
+        searchBestExplosureTime(best[search], blocked[search]);
+      else
+        getBestExplosureTime(best[search], blocked[search]);
+      captures[search]   = ccdCaptureCount - startCaptures;
+      durationMs[search] = millis() - startMs;
+    }
+
+    char name[16];
+    snprintf(name, sizeof(name), explosureSensorOptimumMs > 0 ? "%.0f ms" : "flat",
+             explosureSensorOptimumMs);
+    printf("  %-12s", name);
+    for (int search = 0; search < 2; search++) {
+      printf(" %2lu captures %4lu ms ", captures[search], durationMs[search]);
+      printf(best[search].isValid ? "%3d" : "  -", best[search].explosureTime);
+    }
+    printf("\n");
+
+    bool same = best[0].isValid == best[1].isValid && blocked[0] == blocked[1] &&
+                (!best[0].isValid || best[0].explosureTime == best[1].explosureTime);
+    benchCheck(same, "the explosure search settles elsewhere than the sweep", curve);
+    benchCheck(captures[1] < captures[0] && durationMs[1] < durationMs[0],
+               "the explosure search costs as much as the sweep", curve);
+  }
+  ccdReplaySource = nullptr;
+  halClockSimulated(false);
+}
+
+// the pid of the firmware before it ran on measured time: the gains are per call, there are no
+// limits and no derivative filter
+class benchLegacyPid {
+public:
+  benchLegacyPid(float kp, float ki, float kd) : Kp(kp), Ki(ki), Kd(kd) {}
+
+  float update(float error) {
+    I += error;
+    float D  = error - previous;
+    previous = error;
+    return Kp * error + Ki * I + Kd * D;
+  }
+
+private:
+  float Kp, Ki, Kd;
+  float I = 0, previous = 0;
+};
+
+// the step response comparison: a plant y' = (u - load - y) / tau. the legacy gains are tuned for a
+// control period of cStepPeriodS
+const float cStepPeriodS  = 0.01f;
+const float cStepHalfS    = 3;     // the setpoint or the load steps at the start of either half
+const float cStepPlantTau = 0.2f;  // s
+const float cStepBand     = 0.02f; // settled within this of the setpoint
+const float cStepKp = 2, cStepKi = 10, cStepKd = 0.05f; // per second
+
+// what a controller on measured time has to meet in a half of a scenario
+struct stepBounds {
+  float overshoot;
+  float settleS;
+  float finalError;
+};
+
+struct stepScenario {
+  const char* name;
+  float periodS;     // nominal control period
+  float jitter;      // the control period varies by up to this fraction either way
+  float limit;       // the plant input is limited to +-limit
+  float setpoint[2]; // of the first and the second half, from 0
+  float load[2];
+  stepBounds bounds[2];
+};
+
+// run a controller through a scenario, update(setpoint, measurement, dt) returns the plant input.
+// prints the overshoot (the largest deviation for a load step), the settling time and the mean
+// error of the last 0.5 s of either half. checked against the bounds of the scenario, a half out
+// of them is marked and fails the benchmark
+template <class F>
+void stepResponse(const char* name, const stepScenario& scenario, bool checked, F update) {
+  benchRandomState = 0x12345678; // every controller sees the same periods
+  float y = 0, lastDt = scenario.periodS;
+  for (int half = 0; half < 2; half++) {
+    float target = scenario.setpoint[half];
+    float step   = target - ((half == 0) ? 0 : scenario.setpoint[0]);
+
+    float overshoot = 0, settleS = 0, finalError = 0;
+    int finalSteps = 0;
+    for (float t = 0; t < cStepHalfS;) {
+      float u = update(target, y, lastDt);
+      clamp(u, -scenario.limit, scenario.limit);
+
+      float jitter = float(benchRandom() % 2001) / 1000.0f - 1;
+      float dt     = scenario.periodS * (1 + scenario.jitter * jitter);
+      y += (u - scenario.load[half] - y) * dt / cStepPlantTau;
+      t += dt;
+      lastDt = dt;
+
+      float e   = y - target;
+      overshoot = max(overshoot, (step > 0) ? e : ((step < 0) ? -e : fabsf(e)));
+      if (fabsf(e) > cStepBand)
+        settleS = t;
+      if (t > cStepHalfS - 0.5f) {
+        finalError += fabsf(e);
+        finalSteps++;
+      }
+    }
+    finalError /= finalSteps;
+
+    const stepBounds& bounds = scenario.bounds[half];
+    bool failed = checked && (overshoot > bounds.overshoot || settleS > bounds.settleS ||
+                              finalError > bounds.finalError);
+    benchFailed |= failed;
+    printf("  %-22s %-6s %10.3f %10.2f s %12.4f%s\n", (half == 0) ? name : "",
+           (half == 0) ? "1st" : "2nd", overshoot, settleS, finalError, failed ? "  FAILED" : "");
+  }
+}
+
+void compareStepResponses() {
+  // overshoot, settling time and final error of either half. a setpoint step settles in 0.5 s with
+  // 5 % overshoot, the load step is caught within 15 % and 0.8 s, the jitter and the rate must not
+  // change that. under the input limit the first half cannot get closer than 1.2 - 0.5 = 0.7 and
+  // never settles
+  const stepBounds setpointStep = {0.05f, 0.5f, 0.001f};
+  const stepBounds loadStep     = {0.15f, 0.8f, 0.001f};
+  const stepBounds outOfReach   = {0.05f, cStepHalfS + 1, 0.31f};
+
+  const stepScenario scenarios[] = {
+      {"setpoint 0 -> 1, then load 0.5", cStepPeriodS, 0, 10, {1, 1}, {0, 0.5f},
+       {setpointStep, loadStep}},
+      {"the same, period jitter +-50%", cStepPeriodS, 0.5f, 10, {1, 1}, {0, 0.5f},
+       {setpointStep, loadStep}},
+      {"the same, at twice the rate", cStepPeriodS / 2, 0, 10, {1, 1}, {0, 0.5f},
+       {setpointStep, loadStep}},
+      {"input limit 1.2: load 0.5 at setpoint 1, then setpoint 0.5", cStepPeriodS, 0, 1.2f,
+       {1, 0.5f}, {0.5f, 0.5f}, {outOfReach, setpointStep}},
+  };
+
+  for (const stepScenario& scenario : scenarios) {
+    printf("\n%s\n", scenario.name);
+    printf("  %-22s %-6s %10s %12s %12s\n", "controller", "half", "overshoot", "settling",
+           "final error");
+
+    // the legacy gains are per call, converted at the nominal period. it is the reference, not
+    // checked
+    benchLegacyPid legacy(cStepKp, cStepKi * cStepPeriodS, cStepKd / cStepPeriodS);
+    stepResponse("legacy pid", scenario, false,
+                 [&legacy](float r, float y, float) { return legacy.update(r - y); });
+
+    pid<float> controller(cStepKp, cStepKi, cStepKd);
+    controller.setOutputLimits(-scenario.limit, scenario.limit);
+    controller.setBackCalculation(cStepKi / cStepKp);
+    controller.setDerivativeFilter(cStepPeriodS);
+    controller.setSetpointWeights(1, 0);
+    stepResponse("pid<float>", scenario, true, [&controller](float r, float y, float dt) {
+      return controller.update(r, y, dt);
+    });
+
+    pid<int32_t> fixed(cStepKp, cStepKi, cStepKd);
+    fixed.setOutputLimits(-scenario.limit, scenario.limit);
+    fixed.setBackCalculation(cStepKi / cStepKp);
+    fixed.setDerivativeFilter(cStepPeriodS);
+    fixed.setSetpointWeights(1, 0);
+    stepResponse("pid<int32_t> (q16.16)", scenario, true,
+                 [&fixed](float r, float y, float dt) { return fixed.update(r, y, dt); });
+  }
+}
+
+// the speed pid of the firmware fits q16.16: configured as the motor configures it, pid<int32_t>
+// holds every parameter and follows pid<float> through a speed ramp and step within 1 % (the
+// rounding of q16.16, mostly in the integrator) and 1 / 1000 of full power. the gains of the speed
+// pid before its units were scaled do not fit
+void checkSpeedPidRange() {
+  pid<float> speedFloat(speed_kp, speed_ki, speed_kd);
+  pid<int32_t> speedFixed(speed_kp, speed_ki, speed_kd);
+  configureSpeedPid(speedFloat);
+  configureSpeedPid(speedFixed);
+
+  float worst = 0; // in units of the tolerance
+  for (int step = 0; step < 400; step++) {
+    float speed = (step < 200) ? 0.3f + 0.001f * step : 0.6f;
+    float u     = speedFloat.update(0.5f, speed, 0.005f);
+    float error = fabsf(u - speedFixed.update(0.5f, speed, 0.005f));
+    worst       = max(worst, error / (0.01f * fabsf(u) + 0.001f));
+  }
+  printf("\nspeed pid in q16.16: parameters %s, off pid<float> by up to %.2f of the tolerance\n",
+         speedFixed.inRange() ? "in range" : "OUT OF RANGE", worst);
+  benchFailed |= !speedFixed.inRange() || worst > 1;
+
+  pid<int32_t> unscaled(8e4f, 2e5f, 500);
+  unscaled.setOutputLimits(-cDefaultPower, cMaximumPower - cDefaultPower);
+  printf("unscaled speed gains (8e4, 2e5, 500 per tick / ms): %s\n",
+         unscaled.inRange() ? "in range, FAILED" : "out of range");
+  benchFailed |= unscaled.inRange();
+}
+
+int main(int argc, char** argv) {
+  long iterations = (argc > 1) ? atol(argv[1]) : 200000;
+
+  // the firmware prints, the benchmark should not measure the terminal
+  Serial.setOutput(nullptr);
+  makeFrames();
+
+  printf("%ld iterations, %d frames\n\n", iterations, cBenchFrames);
+  printf("%-34s %13s %17s\n", "stage", "time / call", "heap / call");
+
+  const char* stageNames[] = {"ccd: linear stats + histogram", "ccd: binarize + count",
+                              "ccd: platform detector", "ccd: track search + centre",
+                              "ccd: segment extraction"};
+  double prefix = 0, total = 0;
+  for (int s = 1; s <= 5; s++) {
+    char name[64];
+    snprintf(name, sizeof(name), "  prefix %d", s);
+    benchResult r = bench(name, iterations, [s](long i) { benchSink = runCCDStages(i, s); });
+    printf("  -> %-30s %10.1f ns\n", stageNames[s - 1], r.nsPerCall - prefix);
+    prefix = r.nsPerCall;
+    total  = r.nsPerCall;
+  }
+  printf("%-34s %10.1f ns\n\n", "ccd: all stages / frame", total);
+
+  trackFilter filter(2e5f, 1.0f, 8);
+  bench("track filter predict + update", iterations, [&filter](long i) {
+    filter.predict(0.01f);
+    filter.update(float(i % 128), 0.8f);
+    benchSink = int(filter.position());
+  });
+
+  platformDetector detector(0.7f, 0.5f, 3, 5, 0.05f, 0.3f, 0.01f);
+  bench("platform detector update", iterations,
+        [&detector](long i) { benchSink = detector.update(float(i % 100) / 100.0f, 0.02f); });
+
+  benchLegacyPid legacy(1, 0.01f, 0.1f);
+  bench("pid update (legacy)", iterations,
+        [&legacy](long i) { benchSink = int(legacy.update(float(i % 64) - 32)); });
+
+  pid<float> controller(1, 2, 0.0005f);
+  controller.setOutputLimits(-64, 64);
+  controller.setBackCalculation(2);
+  controller.setDerivativeFilter(0.02f);
+  bench("pid<float> update", iterations, [&controller](long i) {
+    benchSink = int(controller.update(float(i % 64) + 32, 64, 0.005f));
+  });
+
+  pid<int32_t> fixed(1, 2, 0.0005f);
+  fixed.setOutputLimits(-64, 64);
+  fixed.setBackCalculation(2);
+  fixed.setDerivativeFilter(0.02f);
+  bench("pid<int32_t> update (q16.16)", iterations, [&fixed](long i) {
+    int32_t setpoint = int32_t(i % 64 + 32) << 16;
+    benchSink        = fixed.updateRaw(setpoint, 64 << 16, 328) >> 16; // dt 0.005 s
+  });
+
+  speedPlanner planner(1.0f, 1.0f, 0.3f, 0.1f);
+  bench("speed planner update", iterations, [&planner](long i) {
+    benchSink = int(1000 * planner.update(float(i % 64) - 32, float(i % 200) - 100,
+                                          float(i % 50) - 25, 0.8f, 0.005f));
+  });
+
+  bench("colour classification", iterations, [](long i) {
+    outRGB[0] = i % 300;
+    outRGB[1] = (i * 7) % 300;
+    outRGB[2] = (i * 13) % 300;
+    benchSink = parseColor();
+  });
+
+  bt_data packet{}; // zeroed, encode() prints additional_info
+  bench("bt_data encode", iterations, [&packet](long i) {
+    packet.set_cargo(int(i % platform_num) + 1, int(i % 5));
+    packet.set_count(int(i));
+    benchSink = packet.encode()[0];
+  });
+
+  bench("command parsing", iterations, [](long i) {
+    parseCommands(int(i % 256));
+    benchSink = ledcRead(0);
+  });
+
+  compareBinaryLines(iterations);
+  compareThresholds(iterations);
+  compareSampleWidths(iterations);
+  compareExplosureSearch();
+  compareStepResponses();
+  checkSpeedPidRange();
+
+  printf("\n%s\n", benchFailed ? "FAILED" : "all control checks passed");
+  return benchFailed ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+// the firmware built as a linux executable on top of the simulated hal (dep/halLinux.h). the sketch
+// is compiled unchanged: setup() starts the same tasks as threads, and loop() runs on the main
+// thread. the ccd frames are replayed from CCD_REPLAY_FILE when it is set (see dep/ccdCapture.h)
+//
+// build: g++ -std=gnu++17 -O2 -pthread -o firmware host/firmwareMain.cpp
+// run:   CCD_REPLAY_FILE=frames.txt ./firmware
+
+// the arduino ide generates the prototypes of the sketch, a plain compiler needs them up front
+void assignTasks();
+void Task1(void* pvParameters);
+void Task2(void* pvParameters);
+
+#include "../bupt_car_2.ino"
+
+int main() {
+  setup();
+  for (;;)
+    loop();
+}
@@ -0,0 +1,373 @@
+// deterministic replay of a sensor log (dep/sensorLogFormat.h) through the firmware's own tracking
+// and control code on the simulated hal. the log is memory mapped, every ccd frame is handed to
+// processCCD() through the host capture backend, and colour reads are answered by an i2c model of
+// the colour sensor. the clock is virtual and follows the log, so a replay runs as fast as the cpu
+// allows and gives the same result every time.
+//
+// the control steps run on the simulated control timer, its ticks are put in the phase of the
+// car's by the first record a control step logged, or by the first frame of a log of frames only
+// (--from-frames). the records of a step are stamped a little
+// after its tick, so they are matched to the replayed steps by time: encoder edges are pushed into
+// the edge ring of the hall interrupt half a control period before their stamp, i.e. before the
+// step that read them, and a logged actuator snapshot is compared right after the step it is
+// stamped less than half a period after, i.e. the step that wrote it.
+//
+// the replay ends with the frames, or once the clock is a control period past the last record:
+// the firmware does not ask for frames in every state (its error state waits for ever)
+//
+// the output is a csv row for every replayed control step: its duties next to the logged snapshot
+// in effect (the firmware only logs a snapshot that changed, `logged` is 1 on the step that did,
+// the logged columns are empty before the first one). the per-stage timings and the real time
+// factor go to stderr. nothing in the trace depends on the wall clock, a replay repeats it to the
+// byte
+//
+// build: see host/CMakeLists.txt
+// usage: sensorReplay [--motor-off] [--verbose] run.log > trace.csv
+//        sensorReplay --from-frames frames.txt run.log [periodMs]   (make a log of text frames)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+#include "../dep/autotrack.h"
+#include "../dep/sensorLogFormat.h"
+
+struct replayRecord {
+  sensorLogRecordHeader header;
+  const uint8_t* payload;
+};
+
+struct replayFinished {};
+
+// the colour sensor at colorSensorAddr: writing register 0 starts a new read of the six rgb bytes,
+// which takes the next recorded colour
+class replayColorSensor : public halI2cDevice {
+public:
+  void onWrite(const uint8_t* data, int len) override {
+    reg = data[0];
+    if (len == 1 && reg == colorBufferAddr && !pending.empty()) {
+      current = pending.front();
+      pending.pop_front();
+    }
+  }
+
+  int onRead(uint8_t* data, int len) override {
+    for (int i = 0; i < len; i++, reg++) {
+      int channel = (reg - colorBufferAddr) / 2;
+      int value   = (channel >= 0 && channel < 3) ? current.rgb[channel] : 0;
+      data[i]     = ((reg - colorBufferAddr) % 2 == 0) ? value >> 8 : value & 0xff;
+    }
+    return len;
+  }
+
+  std::deque<sensorLogColor> pending;
+
+private:
+  sensorLogColor current{};
+  int reg = 0;
+};
+
+std::vector<replayRecord> replayRecords;
+size_t replayFrameCursor    = 0; // the next ccd record
+size_t replayEncoderCursor  = 0; // the next encoder record
+size_t replayActuatorCursor = 0; // the next actuator record
+uint64_t replayEndUs     = 0; // the stamp of the last record
+replayColorSensor replayColor;
+
+uint32_t replayFrameSeq = 0;
+unsigned long replayCompared = 0, replayMismatches = 0;
+sensorLogActuator replayLogged{}; // the last logged snapshot
+bool replayHasLogged = false;
+
+double replayFeedNs = 0, replayFeedMaxNs = 0;
+double replayStepNs = 0, replayStepMaxNs = 0;
+
+bool replayStepRecord(const replayRecord& record) {
+  return record.header.type == SENSOR_LOG_ENCODER || record.header.type == SENSOR_LOG_ACTUATOR;
+}
+
+// compare the logged actuator snapshots of the step that just ran at nowUs with the replayed
+// duties, and print the row of the step
+void replayCompareStep(uint64_t nowUs) {
+  uint32_t servo = ledcRead(cSensorLogServoChannel);
+  uint32_t motor[4];
+  for (int i = 0; i < 4; i++)
+    motor[i] = ledcRead(cSensorLogMotorChannel + i);
+
+  bool logged = false;
+  for (; replayActuatorCursor < replayRecords.size(); replayActuatorCursor++) {
+    const replayRecord& record = replayRecords[replayActuatorCursor];
+    if (record.header.type != SENSOR_LOG_ACTUATOR)
+      continue;
+    if (record.header.timestampUs >= nowUs + controlPeriodUs / 2)
+      break;
+
+    memcpy(&replayLogged, record.payload, sizeof(replayLogged));
+    replayHasLogged = logged = true;
+    replayCompared++;
+    if (replayLogged.servoDuty != servo ||
+        memcmp(replayLogged.motorDuty, motor, sizeof(motor)) != 0)
+      replayMismatches++;
+  }
+
+  printf("%llu,%u,%d,%.3f,%u,%u,%u,%u,%u,%d,", (unsigned long long)nowUs, replayFrameSeq,
+         lastTrackStatus, lastTrackMidPixel, servo, motor[0], motor[1], motor[2], motor[3],
+         logged ? 1 : 0);
+  if (replayHasLogged)
+    printf("%u,%u,%u,%u,%u\n", replayLogged.servoDuty, replayLogged.motorDuty[0],
+           replayLogged.motorDuty[1], replayLogged.motorDuty[2], replayLogged.motorDuty[3]);
+  else
+    printf(",,,,\n");
+}
+
+// the clock hook: push the encoder edges of the control steps that are due before the clock
+// reaches us
+void replayAdvance(uint64_t us) {
+  uint64_t halfPeriodUs = controlPeriodUs / 2;
+  if (us > replayEndUs + controlPeriodUs)
+    throw replayFinished();
+
+  for (; replayEncoderCursor < replayRecords.size(); replayEncoderCursor++) {
+    const replayRecord& record = replayRecords[replayEncoderCursor];
+    if (record.header.type != SENSOR_LOG_ENCODER)
+      continue;
+    if (record.header.timestampUs > us + halfPeriodUs)
+      return;
+    sensorLogEncoder encoder;
+    memcpy(&encoder, record.payload, sizeof(encoder));
+    for (uint32_t t = 0; t < encoder.ticks; t++)
+      encoderPushEdge(encoder.lastEdgeUs);
+  }
+}
+
+// the frame source of the host capture backend, also queues the colours the car read before the
+// next frame
+void replayNextFrame(uint8_t* frame) {
+  auto start = std::chrono::steady_clock::now();
+
+  while (replayFrameCursor < replayRecords.size() &&
+         replayRecords[replayFrameCursor].header.type != SENSOR_LOG_CCD)
+    replayFrameCursor++;
+  if (replayFrameCursor == replayRecords.size())
+    throw replayFinished();
+
+  const replayRecord& record = replayRecords[replayFrameCursor++];
+  sensorLogCCD ccd;
+  memcpy(&ccd, record.payload, sizeof(ccd));
+  memcpy(frame, ccd.samples, cCCDFramePixels);
+  replayFrameSeq = ccd.seq;
+
+  // the firmware's own delays may have moved the clock past the log already, the control steps
+  // up to the frame run on the way
+  double stepNsBefore = replayStepNs;
+  halAdvanceToUs(record.header.timestampUs);
+
+  for (size_t i = replayFrameCursor; i < replayRecords.size(); i++) {
+    const replayRecord& next = replayRecords[i];
+    if (next.header.type == SENSOR_LOG_CCD)
+      break;
+    if (next.header.type == SENSOR_LOG_COLOR) {
+      sensorLogColor color;
+      memcpy(&color, next.payload, sizeof(color));
+      replayColor.pending.push_back(color);
+    }
+  }
+
+  double ns =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() -
+      (replayStepNs - stepNsBefore);
+  replayFeedNs += ns;
+  replayFeedMaxNs = max(replayFeedMaxNs, ns);
+}
+
+// the control step, timed on the wall clock, and compared with the log
+void replayControlStep(float dt) {
+  auto start = std::chrono::steady_clock::now();
+  controlTrackStep(dt);
+  double ns =
+      std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  replayStepNs += ns;
+  replayStepMaxNs = max(replayStepMaxNs, ns);
+
+  replayCompareStep(micros());
+}
+
+// index the records of a mapped log, anything between them that does not check out is skipped
+bool indexLog(const uint8_t* log, uint32_t length) {
+  sensorLogFileHeader fileHeader;
+  if (length < sizeof(fileHeader))
+    return false;
+  memcpy(&fileHeader, log, sizeof(fileHeader));
+  uint32_t offset = sensorLogValidFileHeader(fileHeader) ? fileHeader.headerSize : 0;
+
+  sensorLogRecordHeader header;
+  while ((offset = sensorLogFind(log, length, offset, header)) < length) {
+    replayRecords.push_back({header, log + offset + sizeof(header)});
+    offset = sensorLogAfter(offset, header);
+  }
+  return !replayRecords.empty();
+}
+
+// make a log of the text frames the host capture backend replays (one frame of 128 values a line)
+int fromFrames(const char* framesPath, const char* logPath, int periodMs) {
+  FILE* in  = fopen(framesPath, "r");
+  FILE* out = fopen(logPath, "wb");
+  if (!in || !out) {
+    fprintf(stderr, "cannot open %s or %s\n", framesPath, logPath);
+    return 1;
+  }
+
+  sensorLogFileHeader fileHeader;
+  sensorLogInitFileHeader(fileHeader);
+  fwrite(&fileHeader, sizeof(fileHeader), 1, out);
+
+  sensorLogCCD ccd{};
+  ccd.explosureTime = periodMs;
+  int val, i = 0;
+  while (fscanf(in, "%d", &val) == 1) {
+    ccd.samples[i++] = (val < 0) ? 0 : (val > cCCDAdcMax ? cCCDAdcMax : val);
+    if (i < cCCDFramePixels)
+      continue;
+    i = 0;
+
+    sensorLogRecordHeader header;
+    sensorLogInitRecord(header, SENSOR_LOG_CCD, &ccd, sizeof(ccd), ccd.seq * periodMs * 1000);
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(&ccd, sizeof(ccd), 1, out);
+    ccd.seq++;
+  }
+
+  fclose(in);
+  fclose(out);
+  fprintf(stderr, "%u frames written to %s\n", ccd.seq, logPath);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 4 && strcmp(argv[1], "--from-frames") == 0)
+    return fromFrames(argv[2], argv[3], (argc > 4) ? atoi(argv[4]) : 10);
+
+  bool motorOn = true, verbose = false;
+  const char* path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--motor-off") == 0)
+      motorOn = false;
+    else if (strcmp(argv[i], "--verbose") == 0)
+      verbose = true;
+    else
+      path = argv[i];
+  }
+  if (!path) {
+    fprintf(stderr, "usage: sensorReplay [--motor-off] [--verbose] run.log > trace.csv\n");
+    return 1;
+  }
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+  const uint8_t* log = (const uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (log == MAP_FAILED || !indexLog(log, uint32_t(st.st_size))) {
+    fprintf(stderr, "%s holds no sensor log records\n", path);
+    return 1;
+  }
+
+  // the firmware's serial output is noise in the trace
+  Serial.setOutput(verbose ? stderr : nullptr);
+  halClockSimulatedFrom(replayRecords.front().header.timestampUs);
+
+  ccdReplaySource = replayNextFrame;
+  halAttachI2cDevice(colorSensorAddr, &replayColor);
+  pinMode(PINOUT_MOTOR_ON, INPUT_PULLDOWN);
+  halSetPin(PINOUT_MOTOR_ON, motorOn ? HIGH : LOW);
+  initCCD();
+  initServo();
+  initMotor();
+  initTracking();
+
+  // the first frame tells the explosure the car was running with
+  explosureRecord bestRecord{};
+  for (const replayRecord& record : replayRecords) {
+    if (record.header.type == SENSOR_LOG_CCD) {
+      sensorLogCCD ccd;
+      memcpy(&ccd, record.payload, sizeof(ccd));
+      bestRecord.explosureTime = ccd.explosureTime;
+      break;
+    }
+  }
+  bestRecord.isValid = true;
+  ccdPipelineStart(bestRecord.explosureTime);
+  trackPeriods.setNominal(ccdPipelineFramePeriodUs());
+  controlSchedulerStart(control_rate_hz, replayControlStep);
+  const replayRecord* firstStep  = NULL;
+  const replayRecord* firstFrame = NULL;
+  for (const replayRecord& record : replayRecords) {
+    if (!firstStep && replayStepRecord(record))
+      firstStep = &record;
+    if (!firstFrame && record.header.type == SENSOR_LOG_CCD)
+      firstFrame = &record;
+    replayEndUs = max(replayEndUs, uint64_t(record.header.timestampUs));
+  }
+  if (firstStep || firstFrame)
+    halTimerAlarmAt(controlTimer, (firstStep ? firstStep : firstFrame)->header.timestampUs);
+  halClockHook = replayAdvance;
+
+  printf("time_us,frame_seq,status,track_mid,servo,motor0,motor1,motor2,motor3,logged,"
+         "logged_servo,logged_motor0,logged_motor1,logged_motor2,logged_motor3\n");
+
+  unsigned long frames = 0;
+  double trackNs = 0, trackMaxNs = 0;
+  uint64_t startUs = micros();
+  auto wallStart   = std::chrono::steady_clock::now();
+
+  bool returnFromPlatform = true;
+  try {
+    for (;;) {
+      // the frame feed and the control steps happen inside autoTrack, they are taken out of the
+      // tracking loop
+      double feedBefore  = replayFeedNs + replayStepNs;
+      auto start         = std::chrono::steady_clock::now();
+      returnFromPlatform = autoTrack(bestRecord, bestRecord.explosureTime, returnFromPlatform);
+      auto end           = std::chrono::steady_clock::now();
+
+      double ns = std::chrono::duration<double, std::nano>(end - start).count() -
+                  (replayFeedNs + replayStepNs - feedBefore);
+      trackNs += ns;
+      trackMaxNs = max(trackMaxNs, ns);
+      frames++;
+    }
+  } catch (const replayFinished&) {
+  }
+  halClockHook = nullptr;
+
+  auto wallEnd        = std::chrono::steady_clock::now();
+  double wallS        = std::chrono::duration<double>(wallEnd - wallStart).count();
+  double simS         = (micros() - startUs) * 1e-6;
+  unsigned long fed   = ccdReplayFrameCount;
+  unsigned long steps = controlTiming.steps;
+
+  fprintf(stderr, "%lu records, %lu frames, %lu tracking loops, %lu control steps\n",
+          (unsigned long)replayRecords.size(), fed, frames, steps);
+  fprintf(stderr, "frame feed:    %8.0f ns mean %8.0f ns max\n", fed ? replayFeedNs / fed : 0.0,
+          replayFeedMaxNs);
+  fprintf(stderr, "tracking loop: %8.0f ns mean %8.0f ns max\n", frames ? trackNs / frames : 0.0,
+          trackMaxNs);
+  fprintf(stderr, "control step:  %8.0f ns mean %8.0f ns max\n",
+          steps ? replayStepNs / steps : 0.0, replayStepMaxNs);
+  fprintf(stderr, "%.3f s of the run replayed in %.3f s (%.0fx real time)\n", simS, wallS,
+          wallS > 0 ? simS / wallS : 0.0);
+  fprintf(stderr, "%lu of %lu logged actuator snapshots differ from the replay\n",
+          replayMismatches, replayCompared);
+
+  munmap((void*)log, st.st_size);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,36 @@
+# round trip of a vehicleSim lap through sensorReplay: the simulator records the sensor log of the
+# lap (frames, encoder ticks, colour reads and the actuator snapshots of the control steps), the
+# replay of it has to give every logged snapshot back, with a trace row for every control step. a
+# second replay repeats the trace to the byte
+#
+# usage: cmake -DSIM=<vehicleSim> -DREPLAY=<sensorReplay> -DWORK=<directory>
+#              -P sensorReplaySimTest.cmake
+
+execute_process(COMMAND ${SIM} --laps 1 --log ${WORK}/vehicleSim.log TIMEOUT 60
+                RESULT_VARIABLE result OUTPUT_VARIABLE report ERROR_VARIABLE report)
+if(NOT result EQUAL 0 OR NOT report MATCHES ", 0 records dropped")
+  message(FATAL_ERROR "the vehicleSim lap failed (${result}): ${report}")
+endif()
+
+execute_process(COMMAND ${REPLAY} ${WORK}/vehicleSim.log TIMEOUT 60 RESULT_VARIABLE result
+                OUTPUT_VARIABLE trace ERROR_VARIABLE log)
+if(NOT result EQUAL 0 OR NOT log MATCHES "([0-9]+) control steps")
+  message(FATAL_ERROR "the replay of the lap failed (${result}): ${log}")
+endif()
+set(steps ${CMAKE_MATCH_1})
+if(NOT log MATCHES "\n0 of ([0-9]+) logged actuator snapshots differ" OR CMAKE_MATCH_1 EQUAL 0)
+  message(FATAL_ERROR "the replay of the lap differs from the log: ${log}")
+endif()
+string(REGEX MATCHALL "\n" rows "${trace}")
+list(LENGTH rows rows)
+math(EXPR rows "${rows} - 1")
+if(NOT rows EQUAL steps)
+  message(FATAL_ERROR "${rows} trace rows for ${steps} control steps")
+endif()
+
+execute_process(COMMAND ${REPLAY} ${WORK}/vehicleSim.log TIMEOUT 60 OUTPUT_VARIABLE again
+                ERROR_QUIET)
+if(NOT again STREQUAL trace)
+  message(FATAL_ERROR "two replays of the same log gave different traces")
+endif()
+message(STATUS "${log}")
@@ -0,0 +1,51 @@
+# round trip of a log of text frames through sensorReplay: --from-frames makes the log, the replay
+# of it has to end by itself. the car follows a line for 10 frames and loses it for the last 10, the
+# firmware stops asking for frames then. the trace has a row for every replayed control step, and a
+# second replay repeats it to the byte
+#
+# usage: cmake -DREPLAY=<sensorReplay> -DWORK=<directory> -P sensorReplayTest.cmake
+
+set(frames "")
+foreach(frame RANGE 19)
+  math(EXPR centre "40 + 3 * ${frame}")
+  set(line "")
+  foreach(pixel RANGE 127)
+    math(EXPR distance "${pixel} - ${centre}")
+    if(frame LESS 10 AND distance GREATER -7 AND distance LESS 7)
+      string(APPEND line " 30")
+    else()
+      string(APPEND line " 200")
+    endif()
+  endforeach()
+  string(APPEND frames "${line}\n")
+endforeach()
+file(WRITE ${WORK}/replayFrames.txt "${frames}")
+
+execute_process(COMMAND ${REPLAY} --from-frames ${WORK}/replayFrames.txt ${WORK}/replay.log 20
+                RESULT_VARIABLE result ERROR_VARIABLE log)
+if(NOT result EQUAL 0 OR NOT log MATCHES "20 frames written")
+  message(FATAL_ERROR "--from-frames failed (${result}): ${log}")
+endif()
+
+execute_process(COMMAND ${REPLAY} ${WORK}/replay.log TIMEOUT 30 RESULT_VARIABLE result
+                OUTPUT_VARIABLE trace ERROR_VARIABLE log)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "the replay of the frames did not end (${result}): ${log}")
+endif()
+if(NOT log MATCHES "20 records, [0-9]+ frames, [0-9]+ tracking loops, ([0-9]+) control steps")
+  message(FATAL_ERROR "the replay of the frames ended without its report: ${log}")
+endif()
+set(steps ${CMAKE_MATCH_1})
+string(REGEX MATCHALL "\n" rows "${trace}")
+list(LENGTH rows rows)
+math(EXPR rows "${rows} - 1")
+if(steps EQUAL 0 OR NOT rows EQUAL steps OR NOT trace MATCHES "^time_us,frame_seq")
+  message(FATAL_ERROR "${rows} trace rows for ${steps} control steps")
+endif()
+
+execute_process(COMMAND ${REPLAY} ${WORK}/replay.log TIMEOUT 30 OUTPUT_VARIABLE again
+                ERROR_QUIET)
+if(NOT again STREQUAL trace)
+  message(FATAL_ERROR "two replays of the same log gave different traces")
+endif()
+message(STATUS "${log}")
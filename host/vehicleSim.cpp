@@ -0,0 +1,767 @@
+// closed loop simulation of the car on a track, to compare controller gains, speeds or line
+// detectors without driving the car. the firmware's own autoTrack() runs on the simulated hal
+// against a model of everything around it:
+// - a kinematic bicycle (ackermann) model, steered through the inverse of servoWriteAngle()'s
+//   mapping and the slew rate of the servo
+// - a first order motor model driven by the motor pwm duties, its encoder clocks the hall interrupt
+// - a tsl1401 renderer: the ground under the sensor line is drawn from the track polyline and its
+//   platform bars, integrated over the explosure with motion blur, vignetting and noise
+// - the colour sensor on the i2c bus, which sees the cargo of the platform the car stopped at
+//
+// the clock is virtual and the models are stepped with it (halClockHook), a run is reproducible and
+// goes as fast as the cpu allows. reported are the lap times, the cross-track error of the car and
+// how far from the platform bars it stopped
+//
+// a track is a list of pieces, the car starts at the beginning of the first one:
+//   width 0.025          line width in m
+//   straight 1.0         m
+//   arc 0.5 90           radius in m, degrees to turn, positive turns left
+//   platform red         a platform bar with its cargo (red, green, blue, yellow or empty) here
+// the pieces have to close the loop, and the track must not cross itself
+//
+// build: see host/CMakeLists.txt
+// usage: vehicleSim [options], vehicleSim --help lists them
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../dep/autotrack.h"
+
+// car, its geometry (wheelbase, sensor position and pitch, encoder) is the one of args.h the
+// firmware assumes
+const float cSimSensorAxisPixel = (cCountStart + cCountEnd) / 2.0f; // looks straight ahead
+const float cSimServoRate       = 500.0f; // deg / s of the servo horn
+const float cSimTopSpeed        = 2.0f;   // m / s at full duty
+const float cSimMotorTau        = 0.15f;  // s, driven
+const float cSimBrakeTau        = 0.05f;  // s, both motor pins high (shorted)
+const float cSimCoastTau        = 0.6f;   // s, both motor pins low
+const float cSimFriction        = 0.3f;   // m / s^2
+
+// ccd
+const float cSimSensitivity = 3.0f; // adc counts per ms of integration on a white ground
+const float cSimDarkLevel   = 6.0f;
+const int cSimNoise         = 2; // counts, peak
+const float cSimVignetting  = 0.25f; // of the brightness lost at the ends of the line
+const int cSimSubSamples    = 4;     // per pixel
+const int cSimBlurPoses     = 3;     // per frame, spread over the integration
+
+// ground
+const float cSimFloorReflectance = 0.85f;
+const float cSimLineReflectance  = 0.10f;
+const float cSimBarReflectance   = 0.08f;
+
+// track
+const float cSimTrackSpacing = 0.02f; // m between the polyline points
+const float cSimBarLength    = 0.15f; // m along the track
+const float cSimBarWidth     = 0.30f; // m across the track
+const float cSimCargoReach   = 0.3f;  // m, the colour sensor sees a cargo this close
+const float cSimOffTrack     = 0.15f; // m, the run ends when the car is this far off the line
+const int cSimSearchWindow   = 25;    // polyline points searched on either side of the last one
+
+const uint64_t cSimStepUs  = 1000;
+const int cSimPoseRingSize = 512; // steps of pose history, covers the longest explosure
+
+// colour sensor, the cargo of a platform adds to the blank (indexed by COLOR_*)
+const uint16_t cSimBlankRGB[3]    = {120, 130, 110};
+const uint16_t cSimCargoRGB[5][3] = {
+    {300, 30, 20}, {20, 300, 30}, {20, 40, 300}, {300, 280, 30}, {0, 0, 0}};
+
+const char* cSimDefaultTrack = "width 0.025\n"
+                               "straight 1.0\n"
+                               "platform red\n"
+                               "straight 1.0\n"
+                               "arc 0.5 90\n"
+                               "straight 0.5\n"
+                               "platform green\n"
+                               "straight 0.5\n"
+                               "arc 0.5 90\n"
+                               "straight 1.0\n"
+                               "platform blue\n"
+                               "straight 1.0\n"
+                               "arc 0.5 90\n"
+                               "straight 0.5\n"
+                               "platform yellow\n"
+                               "straight 0.5\n"
+                               "arc 0.5 90\n";
+
+struct simBar {
+  float s;      // of the bar centre along the track
+  float x, y;   // bar centre
+  float tx, ty; // track direction
+  int cargo;    // COLOR_*
+};
+
+struct simTrack {
+  std::vector<float> x, y, s; // closed polyline, s is the distance from the start
+  std::vector<simBar> bars;
+  float length    = 0;
+  float lineWidth = 0.025f;
+};
+
+struct simPose {
+  uint64_t us;
+  float x, y, heading;
+};
+
+// the state of the car, x / y / heading are of the rear axle centre
+struct simCar {
+  float x, y, heading;
+  float speed;
+  float servoAngle; // deg of the servo horn
+  float tickDistance;
+};
+
+struct simStop {
+  int lap, bar;
+  float error;  // m the sensor line stopped past the bar centre
+  float speed;  // m / s when the cargo was read
+  int cargo;    // on the platform
+  int detected; // what the firmware read, -1 until it has
+};
+
+struct simFinished {
+  const char* reason;
+};
+
+simTrack simWorld;
+simCar simState{};
+simPose simPoses[cSimPoseRingSize];
+unsigned long simPoseCount = 0;
+uint64_t simUs             = 0;
+uint64_t simEndUs          = 0;
+uint32_t simRandomState    = 0x2545f491;
+
+// progress along the track, unwrapped over the laps
+int simCentreHint = -1, simSensorHint = -1;
+float simCentreProgress = 0, simSensorProgress = 0;
+float simCentreError = 0;
+
+// results
+bool simTracking         = false;
+uint64_t simTrackStartUs = 0, simLapStartUs = 0;
+int simLapsToRun         = 2;
+std::vector<double> simLapTimes;
+double simErrorSquareSum = 0, simErrorSum = 0, simErrorMax = 0;
+unsigned long simErrorSamples = 0;
+std::vector<simStop> simStops;
+int simBarsPassed = 0;
+
+// track
+
+// the xorshift of the bench, the noise is the same on every run of a seed
+uint32_t simRandom() {
+  simRandomState ^= simRandomState << 13;
+  simRandomState ^= simRandomState >> 17;
+  simRandomState ^= simRandomState << 5;
+  return simRandomState;
+}
+
+void simAddPoint(simTrack& track, float x, float y) {
+  float ds = track.x.empty() ? 0 : hypotf(x - track.x.back(), y - track.y.back());
+  track.s.push_back(track.s.empty() ? 0 : track.s.back() + ds);
+  track.x.push_back(x);
+  track.y.push_back(y);
+}
+
+int simCargoByName(const char* name) {
+  for (int c = COLOR_RED; c <= COLOR_EMPTY; c++)
+    if (strcasecmp(name, colorLookupArray[c]) == 0)
+      return c;
+  return -1;
+}
+
+// build the polyline of a track description, returns false on a line it does not understand
+bool simBuildTrack(simTrack& track, const std::string& text) {
+  float x = 0, y = 0, heading = 0;
+  simAddPoint(track, x, y);
+
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end       = text.find('\n', pos);
+    std::string line = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    pos              = (end == std::string::npos) ? text.size() : end + 1;
+
+    char word[16], name[16] = "empty";
+    float a = 0, b = 0;
+    if (line.empty() || line[0] == '#' || sscanf(line.c_str(), "%15s", word) != 1)
+      continue;
+
+    if (strcmp(word, "width") == 0 && sscanf(line.c_str(), "%*s %f", &a) == 1) {
+      track.lineWidth = a;
+    } else if (strcmp(word, "straight") == 0 && sscanf(line.c_str(), "%*s %f", &a) == 1) {
+      int n = int(ceilf(a / cSimTrackSpacing));
+      for (int i = 0; i < n; i++) {
+        x += a / n * cosf(heading);
+        y += a / n * sinf(heading);
+        simAddPoint(track, x, y);
+      }
+    } else if (strcmp(word, "arc") == 0 && sscanf(line.c_str(), "%*s %f %f", &a, &b) == 2) {
+      // the turn centre is to the left for a positive angle
+      float turn = b * float(M_PI) / 180.0f;
+      float side = (turn > 0) ? 1.0f : -1.0f;
+      float cx = x - side * a * sinf(heading), cy = y + side * a * cosf(heading);
+      int n = int(ceilf(fabsf(turn) * a / cSimTrackSpacing));
+      for (int i = 0; i < n; i++) {
+        heading += turn / n;
+        x = cx + side * a * sinf(heading);
+        y = cy - side * a * cosf(heading);
+        simAddPoint(track, x, y);
+      }
+    } else if (strcmp(word, "platform") == 0) {
+      sscanf(line.c_str(), "%*s %15s", name);
+      int cargo = simCargoByName(name);
+      if (cargo < 0)
+        return false;
+      track.bars.push_back({track.s.back(), x, y, cosf(heading), sinf(heading), cargo});
+    } else {
+      return false;
+    }
+  }
+
+  // the last point closes the loop onto the first one
+  if (track.x.size() > 1 && hypotf(x - track.x[0], y - track.y[0]) < cSimTrackSpacing / 2) {
+    track.x.pop_back();
+    track.y.pop_back();
+    track.s.pop_back();
+  }
+  track.length = track.s.back() + hypotf(track.x.back() - track.x[0], track.y.back() - track.y[0]);
+  return track.x.size() > 2;
+}
+
+// the distance of (x, y) to the track, positive to the right of it, and where along the track it
+// is. only the polyline points near hint are searched, the whole track if hint is -1
+float simProject(const simTrack& track, float x, float y, int& hint, float& s) {
+  int n     = int(track.x.size());
+  int from  = (hint < 0) ? 0 : hint - cSimSearchWindow;
+  int count = (hint < 0) ? n : 2 * cSimSearchWindow;
+
+  float best = 1e9f, bestLateral = 0;
+  for (int k = 0; k < count; k++) {
+    int i = ((from + k) % n + n) % n, j = (i + 1) % n;
+    float tx = track.x[j] - track.x[i], ty = track.y[j] - track.y[i];
+    float len = hypotf(tx, ty);
+    float u   = ((x - track.x[i]) * tx + (y - track.y[i]) * ty) / (len * len);
+    u         = (u < 0) ? 0 : (u > 1 ? 1 : u);
+    float dx = x - (track.x[i] + u * tx), dy = y - (track.y[i] + u * ty);
+    float d  = hypotf(dx, dy);
+    if (d < best) {
+      best        = d;
+      bestLateral = (tx * dy - ty * dx > 0) ? -d : d;
+      hint        = i;
+      s           = track.s[i] + u * len;
+    }
+  }
+  return bestLateral;
+}
+
+// follow a position along the track over the laps
+void simUnwrap(float s, float& progress) {
+  float delta = s - fmodf(progress, simWorld.length);
+  if (delta < -simWorld.length / 2)
+    delta += simWorld.length;
+  else if (delta > simWorld.length / 2)
+    delta -= simWorld.length;
+  progress += delta;
+}
+
+// ccd renderer
+
+// the parts of the track that can show up on the sensor line of one pose, found once per pose so a
+// sample only has to look at a few polyline segments
+struct simView {
+  int segments[2 * cSimSearchWindow];
+  int segmentNum;
+  std::vector<const simBar*> bars;
+};
+
+void simFindView(simView& view, float cx, float cy, float heading, int hint) {
+  float reach = cCCDFramePixels * car_sensor_pitch; // from the centre to beyond either end
+  float ax = cosf(heading), ay = sinf(heading);
+
+  int n           = int(simWorld.x.size());
+  view.segmentNum = 0;
+  for (int k = -cSimSearchWindow; k < cSimSearchWindow; k++) {
+    int i = ((hint + k) % n + n) % n, j = (i + 1) % n;
+    float mx = (simWorld.x[i] + simWorld.x[j]) / 2 - cx;
+    float my = (simWorld.y[i] + simWorld.y[j]) / 2 - cy;
+    if (fabsf(mx * ax + my * ay) < simWorld.lineWidth / 2 + cSimTrackSpacing &&
+        hypotf(mx, my) < reach)
+      view.segments[view.segmentNum++] = i;
+  }
+
+  view.bars.clear();
+  for (const simBar& bar : simWorld.bars)
+    if (hypotf(bar.x - cx, bar.y - cy) < reach + cSimBarLength + cSimBarWidth)
+      view.bars.push_back(&bar);
+}
+
+// how much light the ground at (x, y) reflects
+float simReflectance(const simView& view, float x, float y) {
+  for (const simBar* bar : view.bars) {
+    float dx = x - bar->x, dy = y - bar->y;
+    if (fabsf(dx * bar->tx + dy * bar->ty) < cSimBarLength / 2 &&
+        fabsf(dx * bar->ty - dy * bar->tx) < cSimBarWidth / 2)
+      return cSimBarReflectance;
+  }
+
+  int n = int(simWorld.x.size());
+  for (int k = 0; k < view.segmentNum; k++) {
+    int i = view.segments[k], j = (i + 1) % n;
+    float tx = simWorld.x[j] - simWorld.x[i], ty = simWorld.y[j] - simWorld.y[i];
+    float u = ((x - simWorld.x[i]) * tx + (y - simWorld.y[i]) * ty) / (tx * tx + ty * ty);
+    u       = (u < 0) ? 0 : (u > 1 ? 1 : u);
+    if (hypotf(x - simWorld.x[i] - u * tx, y - simWorld.y[i] - u * ty) < simWorld.lineWidth / 2)
+      return cSimLineReflectance;
+  }
+  return cSimFloorReflectance;
+}
+
+// the pose of the car at `us`, from the history of the physics steps
+simPose simPoseAt(uint64_t us) {
+  unsigned long oldest = (simPoseCount > cSimPoseRingSize) ? simPoseCount - cSimPoseRingSize : 0;
+  for (unsigned long i = simPoseCount; i > oldest; i--) {
+    const simPose& pose = simPoses[(i - 1) % cSimPoseRingSize];
+    if (pose.us <= us)
+      return pose;
+  }
+  return simPoses[oldest % cSimPoseRingSize];
+}
+
+uint64_t simLastReadoutUs = 0;
+
+// the frame source of the host capture backend. once the pipeline runs, the frames follow the
+// frame timer of the car: one every explosure time, integrated for exactly that long. before, the
+// firmware waits for the explosure itself and a frame is integrated since the last readout
+void simNextFrame(uint8_t* frame) {
+  uint64_t readoutUs  = micros();
+  float integrationMs = (readoutUs - simLastReadoutUs) * 1e-3f;
+  if (ccdPipelineRunning) {
+    readoutUs     = max(readoutUs, simLastReadoutUs + uint64_t(ccdPipelineExplosureTime) * 1000);
+    integrationMs = ccdPipelineExplosureTime;
+  }
+  halAdvanceToUs(readoutUs);
+  simLastReadoutUs = readoutUs;
+
+  static simView view;
+  float light[cCCDFramePixels]{};
+  for (int p = 0; p < cSimBlurPoses; p++) {
+    uint64_t us  = readoutUs - uint64_t(integrationMs * 1000 * (p + 0.5f) / cSimBlurPoses);
+    simPose pose = simPoseAt(us);
+    float cx     = pose.x + car_sensor_ahead * cosf(pose.heading);
+    float cy     = pose.y + car_sensor_ahead * sinf(pose.heading);
+    float rx = sinf(pose.heading), ry = -cosf(pose.heading); // to the right
+    int hint = simSensorHint;
+    float s;
+    simProject(simWorld, cx, cy, hint, s);
+    simFindView(view, cx, cy, pose.heading, hint);
+
+    for (int i = 0; i < cCCDFramePixels; i++) {
+      for (int k = 0; k < cSimSubSamples; k++) {
+        float offset = (i + (k + 0.5f) / cSimSubSamples - 0.5f - cSimSensorAxisPixel) *
+                       car_sensor_pitch;
+        light[i] += simReflectance(view, cx + offset * rx, cy + offset * ry);
+      }
+    }
+  }
+
+  for (int i = 0; i < cCCDFramePixels; i++) {
+    float edge = (i - cCCDFramePixels / 2.0f) / (cCCDFramePixels / 2.0f);
+    float val  = light[i] / (cSimBlurPoses * cSimSubSamples) * (1 - cSimVignetting * edge * edge) *
+                cSimSensitivity * integrationMs;
+    int noisy = int(val + cSimDarkLevel) + int(simRandom() % (2 * cSimNoise + 1)) - cSimNoise;
+    frame[i]  = (noisy < 0) ? 0 : (noisy > cCCDAdcMax ? cCCDAdcMax : noisy);
+  }
+
+  // the colour the firmware classified at the last stop
+  if (!simStops.empty() && simStops.back().detected < 0)
+    simStops.back().detected = color;
+}
+
+// car model
+
+// the wheel angle in deg of a servo horn angle, the inverse of servoWriteAngle()'s mapping. the
+// servo is trimmed so that its zero is at cBias
+float simWheelAngle(float servoAngle) {
+  float wheel = (servoAngle < 0) ? servoAngle * 42.0f / 47.0f : servoAngle * 42.0f / 80.0f;
+  return wheel - cBias;
+}
+
+// the servo horn angle the pwm duty of the servo channel asks for
+float simServoTarget() {
+  float pulseMs = float(ledcRead(0)) / float((1 << cServoResolution) - 1) * 20.0f;
+  return (pulseMs - 0.5f) / 2.0f * 180.0f - 90.0f;
+}
+
+void simStep(float dt) {
+  simCar& car = simState;
+
+  float move = simServoTarget() - car.servoAngle;
+  move       = (move > cSimServoRate * dt) ? cSimServoRate * dt : move;
+  move       = (move < -cSimServoRate * dt) ? -cSimServoRate * dt : move;
+  car.servoAngle += move;
+
+  // both sides get the same duties, the average of the two is the drive
+  float forward = (halLedcDutyRatio(PWM_CHANNEL_LEFT_MOTOR_FRONT) +
+                   halLedcDutyRatio(PWM_CHANNEL_RIGHT_MOTOR_FRONT)) /
+                  2;
+  float backward = (halLedcDutyRatio(PWM_CHANNEL_LEFT_MOTOR_BACK) +
+                    halLedcDutyRatio(PWM_CHANNEL_RIGHT_MOTOR_BACK)) /
+                   2;
+  float accel;
+  if (forward > 0 && backward > 0)
+    accel = -car.speed / cSimBrakeTau * min(forward, backward);
+  else if (forward == backward)
+    accel = -car.speed / cSimCoastTau;
+  else
+    accel = ((forward - backward) * cSimTopSpeed - car.speed) / cSimMotorTau;
+
+  float speed    = car.speed + accel * dt;
+  float friction = cSimFriction * dt;
+  speed          = (speed > 0) ? max(speed - friction, 0.0f) : min(speed + friction, 0.0f);
+
+  // positive wheel angles steer to the right, towards the higher pixels
+  float ds  = (car.speed + speed) / 2 * dt;
+  car.speed = speed;
+  car.heading -= ds * tanf(simWheelAngle(car.servoAngle) * float(M_PI) / 180.0f) / car_wheelbase;
+  car.x += ds * cosf(car.heading);
+  car.y += ds * sinf(car.heading);
+
+  // the hall encoder has a single channel, it counts either way. the interrupt stamps the edges
+  // with the virtual clock, which is put to the time in the step the wheel passes each of them
+  float ticks = fabsf(ds) * encoder_ticks_per_m;
+  float start = car.tickDistance;
+  car.tickDistance += ticks;
+  for (int k = 1; car.tickDistance >= 1; car.tickDistance -= 1, k++) {
+    halSimulatedUs = simUs + uint64_t((k - start) / ticks * dt * 1e6f);
+    halSetPin(PINOUT_E2A, LOW);
+    halSetPin(PINOUT_E2A, HIGH);
+  }
+}
+
+// lap times, cross-track error and the platform bars passed, after every step
+void simMeasure() {
+  const simCar& car = simState;
+  float cx = car.x + car_wheelbase / 2 * cosf(car.heading);
+  float cy = car.y + car_wheelbase / 2 * sinf(car.heading);
+  float sx = car.x + car_sensor_ahead * cosf(car.heading);
+  float sy = car.y + car_sensor_ahead * sinf(car.heading);
+
+  float s, sensorS;
+  simCentreError = simProject(simWorld, cx, cy, simCentreHint, s);
+  simProject(simWorld, sx, sy, simSensorHint, sensorS);
+
+  float prevSensor = simSensorProgress;
+  simUnwrap(s, simCentreProgress);
+  simUnwrap(sensorS, simSensorProgress);
+  if (!simTracking)
+    return;
+
+  if (fabsf(simCentreError) > cSimOffTrack)
+    throw simFinished{"the car left the track"};
+
+  if (car.speed > 0) {
+    double error = fabs(simCentreError);
+    simErrorSum += simCentreError;
+    simErrorSquareSum += error * error;
+    simErrorMax = max(simErrorMax, error);
+    simErrorSamples++;
+  }
+
+  // a bar is passed once the sensor line is over its far end
+  for (const simBar& bar : simWorld.bars) {
+    float end    = bar.s + cSimBarLength / 2;
+    float before = floorf((prevSensor - end) / simWorld.length);
+    float after  = floorf((simSensorProgress - end) / simWorld.length);
+    if (before != after)
+      simBarsPassed++;
+  }
+
+  if (simCentreProgress >= simWorld.length * (simLapTimes.size() + 1)) {
+    simLapTimes.push_back((simUs - simLapStartUs) * 1e-6);
+    simLapStartUs = simUs;
+    if (int(simLapTimes.size()) == simLapsToRun)
+      throw simFinished{NULL};
+  }
+}
+
+// the clock hook, steps the car up to the new time
+void simAdvance(uint64_t toUs) {
+  while (simUs < toUs) {
+    uint64_t stepUs = min(cSimStepUs, toUs - simUs);
+    simStep(stepUs * 1e-6f);
+    simUs += stepUs;
+    simPoses[simPoseCount++ % cSimPoseRingSize] = {simUs, simState.x, simState.y,
+                                                   simState.heading};
+    simMeasure();
+  }
+  if (sensorLogRunning)
+    sensorLogDrain();
+  if (simUs >= simEndUs)
+    throw simFinished{"out of time"};
+}
+
+// the colour sensor at colorSensorAddr: a read of register 0 samples the ground under it, which is
+// the cargo of a platform when the car has stopped there
+class simColorSensor : public halI2cDevice {
+public:
+  void onWrite(const uint8_t* data, int len) override {
+    reg = data[0];
+    if (len == 1 && reg == colorBufferAddr)
+      sample();
+  }
+
+  int onRead(uint8_t* data, int len) override {
+    for (int i = 0; i < len; i++, reg++) {
+      int channel = (reg - colorBufferAddr) / 2;
+      int value   = (channel >= 0 && channel < 3) ? current[channel] : 0;
+      data[i]     = ((reg - colorBufferAddr) % 2 == 0) ? value >> 8 : value & 0xff;
+    }
+    return len;
+  }
+
+private:
+  void sample() {
+    for (int c = 0; c < 3; c++)
+      current[c] = cSimBlankRGB[c];
+    if (!simTracking || simWorld.bars.empty())
+      return;
+
+    // the bar closest to the sensor line, the stop is counted against it
+    float sensorS = fmodf(simSensorProgress, simWorld.length);
+    int nearest   = 0;
+    float error   = 1e9f;
+    for (int b = 0; b < int(simWorld.bars.size()); b++) {
+      float d = sensorS - simWorld.bars[b].s;
+      d       = (d > simWorld.length / 2) ? d - simWorld.length : d;
+      d       = (d < -simWorld.length / 2) ? d + simWorld.length : d;
+      if (fabsf(d) < fabsf(error)) {
+        error   = d;
+        nearest = b;
+      }
+    }
+
+    int cargo = COLOR_EMPTY;
+    if (fabsf(error) < cSimCargoReach) {
+      cargo = simWorld.bars[nearest].cargo;
+      for (int c = 0; c < 3; c++)
+        current[c] += cSimCargoRGB[cargo][c];
+    }
+    simStops.push_back({int(simLapTimes.size()) + 1, nearest, error, simState.speed, cargo, -1});
+  }
+
+  uint16_t current[3]{};
+  int reg = 0;
+};
+
+simColorSensor simColor;
+HardwareSerial simLog(nullptr); // the sensor log, --log
+
+bool simParseGains(const char* text, float& kp, float& ki, float& kd) {
+  return sscanf(text, "%f,%f,%f", &kp, &ki, &kd) == 3;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: vehicleSim [options]\n"
+          "  --track file            track description, a built in loop of 9.1 m by default\n"
+          "  --laps n                laps to run, 2 by default\n"
+          "  --time s                give up after s simulated seconds, 120 by default\n"
+          "  --explosure ms          skip the explosure calibration\n"
+          "  --top-speed v           instead of plan_top_speed (ticks / ms, 1 tick = 1 mm)\n"
+          "  --aim-speed v           instead of aim_speed\n"
+          "  --lateral-accel a       instead of plan_lateral_accel (m / s^2)\n"
+          "  --angle-pid kp,ki,kd    instead of angle_kp, angle_ki, angle_kd\n"
+          "  --speed-pid kp,ki,kd    instead of speed_kp, speed_ki, speed_kd\n"
+          "  --seed n                of the sensor noise\n"
+          "  --trace file.csv        the state of the car after every control step\n"
+          "  --log file.log          record the sensor log of the run, for sensorReplay\n"
+          "  --verbose               show the firmware's serial output\n");
+}
+
+int main(int argc, char** argv) {
+  std::string trackText = cSimDefaultTrack;
+  const char* trackName = "built in";
+  const char* tracePath = NULL;
+  const char* logPath   = NULL;
+  double timeLimit      = 120;
+  int explosure         = 0;
+  bool verbose          = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue   = i + 1 < argc;
+    float kp, ki, kd;
+    if (arg == "--verbose") {
+      verbose = true;
+    } else if (arg == "--track" && hasValue) {
+      trackName = argv[++i];
+      FILE* in  = fopen(trackName, "r");
+      if (!in) {
+        fprintf(stderr, "cannot open %s\n", trackName);
+        return 1;
+      }
+      trackText.clear();
+      for (int c; (c = fgetc(in)) != EOF;)
+        trackText += char(c);
+      fclose(in);
+    } else if (arg == "--laps" && hasValue) {
+      simLapsToRun = atoi(argv[++i]);
+    } else if (arg == "--time" && hasValue) {
+      timeLimit = atof(argv[++i]);
+    } else if (arg == "--explosure" && hasValue) {
+      explosure = atoi(argv[++i]);
+    } else if (arg == "--top-speed" && hasValue) {
+      trackTopSpeed = atof(argv[++i]);
+    } else if (arg == "--aim-speed" && hasValue) {
+      trackAimSpeed = atof(argv[++i]);
+    } else if (arg == "--lateral-accel" && hasValue) {
+      trackPlanner = speedPlanner(atof(argv[++i]), plan_accel, plan_min_speed, cPlanPreviewTime);
+    } else if (arg == "--angle-pid" && hasValue && simParseGains(argv[++i], kp, ki, kd)) {
+      angelPID.setGains(kp, ki, kd);
+    } else if (arg == "--speed-pid" && hasValue && simParseGains(argv[++i], kp, ki, kd)) {
+      motorPID.setGains(kp, ki, kd);
+    } else if (arg == "--seed" && hasValue) {
+      simRandomState = strtoul(argv[++i], NULL, 0) | 1;
+    } else if (arg == "--trace" && hasValue) {
+      tracePath = argv[++i];
+    } else if (arg == "--log" && hasValue) {
+      logPath = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (!simBuildTrack(simWorld, trackText)) {
+    fprintf(stderr, "%s is not a valid track\n", trackName);
+    return 1;
+  }
+  FILE* trace = tracePath ? fopen(tracePath, "w") : NULL;
+  if (tracePath && !trace) {
+    fprintf(stderr, "cannot open %s\n", tracePath);
+    return 1;
+  }
+  FILE* log = logPath ? fopen(logPath, "wb") : NULL;
+  if (logPath && !log) {
+    fprintf(stderr, "cannot open %s\n", logPath);
+    return 1;
+  }
+
+  // the car stands on the start of the track with its centre on the line
+  simState.x       = simWorld.x[0] - car_wheelbase / 2;
+  simState.y       = simWorld.y[0];
+  simState.heading = 0;
+  simPoses[simPoseCount++] = {0, simState.x, simState.y, simState.heading};
+  simMeasure();
+
+  Serial.setOutput(verbose ? stderr : nullptr);
+  halClockSimulatedFrom(0);
+  simEndUs     = uint64_t(timeLimit * 1e6);
+  halClockHook = simAdvance;
+
+  ccdReplaySource = simNextFrame;
+  halAttachI2cDevice(colorSensorAddr, &simColor);
+  pinMode(PINOUT_MOTOR_ON, INPUT_PULLDOWN);
+  halSetPin(PINOUT_MOTOR_ON, HIGH);
+
+  // what setup() and Task2 do before the tracking loop. the sensor log is drained as the clock
+  // moves (simAdvance), there is no task for it
+  simLog.setOutput(log);
+  if (log)
+    sensorLogStart(simLog, false);
+  initColor();
+  initCCD();
+  initServo();
+  initMotor();
+  initTracking();
+  colorSensorOn();
+
+  auto wallStart       = std::chrono::steady_clock::now();
+  const char* failure  = NULL;
+  explosureRecord bestRecord{};
+  bool cameraIsBlocked = false;
+
+  if (trace)
+    fprintf(trace, "time_s,x,y,heading_deg,speed,wheel_deg,progress,error_mm,status,track_mid\n");
+
+  try {
+    setupBlankColor();
+    if (explosure > 0) {
+      bestRecord.explosureTime = explosure;
+      bestRecord.isValid       = true;
+    } else {
+      calibrateExplosure(bestRecord, cameraIsBlocked);
+    }
+    if (!bestRecord.isValid || cameraIsBlocked)
+      throw simFinished{"the explosure calibration failed"};
+    ccdPipelineStart(bestRecord.explosureTime);
+    trackPeriods.setNominal(ccdPipelineFramePeriodUs());
+    controlSchedulerStart(control_rate_hz, controlTrackStep);
+
+    simTracking     = true;
+    simTrackStartUs = simLapStartUs = simUs;
+    bool returnFromPlatform         = true;
+    for (;;) {
+      returnFromPlatform = autoTrack(bestRecord, bestRecord.explosureTime, returnFromPlatform);
+      if (trace)
+        fprintf(trace, "%.3f,%.4f,%.4f,%.2f,%.3f,%.2f,%.4f,%.1f,%d,%.2f\n", simUs * 1e-6,
+                simState.x, simState.y, simState.heading * 180 / M_PI, simState.speed,
+                simWheelAngle(simState.servoAngle), simCentreProgress, simCentreError * 1000,
+                lastTrackStatus, lastTrackMidPixel);
+    }
+  } catch (const simFinished& finished) {
+    failure = finished.reason;
+  }
+
+  halClockHook = nullptr;
+  auto wallEnd = std::chrono::steady_clock::now();
+  double wallS = std::chrono::duration<double>(wallEnd - wallStart).count();
+  double simS  = simUs * 1e-6;
+  if (trace)
+    fclose(trace);
+  if (log) {
+    sensorLogDrain();
+    fclose(log);
+  }
+
+  printf("track:       %s, %.2f m, %d platforms\n", trackName, simWorld.length,
+         int(simWorld.bars.size()));
+  printf("explosure:   %d ms %s, %d ms at the end\n", bestRecord.explosureTime,
+         explosure > 0 ? "given" : "calibrated", autoExplosureTime);
+  printf("tracking:    started at %.3f s\n", simTrackStartUs * 1e-6);
+  for (size_t lap = 0; lap < simLapTimes.size(); lap++)
+    printf("lap %zu:       %.3f s\n", lap + 1, simLapTimes[lap]);
+  if (simErrorSamples > 0)
+    printf("cross-track: %.1f mm rms, %.1f mm max, %+.1f mm mean (+ is right of the line)\n",
+           sqrt(simErrorSquareSum / simErrorSamples) * 1000, simErrorMax * 1000,
+           simErrorSum / simErrorSamples * 1000);
+
+  double stopSquareSum = 0, stopMax = 0;
+  for (const simStop& stop : simStops) {
+    printf("stop:        lap %d bar %d, %+.1f mm past the bar centre, %.2f m/s, %s read as %s\n",
+           stop.lap, stop.bar + 1, stop.error * 1000, stop.speed, colorLookupArray[stop.cargo],
+           stop.detected < 0 ? "-" : colorLookupArray[stop.detected]);
+    stopSquareSum += stop.error * stop.error;
+    stopMax = max(stopMax, double(fabsf(stop.error)));
+  }
+  printf("platforms:   %d stops, %d bars passed", int(simStops.size()), simBarsPassed);
+  if (!simStops.empty())
+    printf(", stop error %.1f mm rms, %.1f mm max", sqrt(stopSquareSum / simStops.size()) * 1000,
+           stopMax * 1000);
+  printf("\n");
+  printf("simulated:   %.3f s in %.3f s (%.0fx real time)\n", simS, wallS,
+         wallS > 0 ? simS / wallS : 0.0);
+  if (log)
+    printf("sensor log:  %s, %lu records dropped\n", logPath, sensorLogDrops);
+
+  if (failure) {
+    const char* statusNames[] = {"NORMAL", "NO_TRACK", "PLATFORM", "COASTING"};
+    printf("failed:      %s at %.3f s, %.2f m along the track, last status %s\n", failure, simS,
+           simCentreProgress, statusNames[lastTrackStatus]);
+    return 1;
+  }
+  return 0;
+}
@@ -192,4 +192,6 @@ private:
 
 extern I2SClass I2S;
 
+#include "I2S.cpp"
+
 #endif
@@ -74,4 +74,6 @@ class Preferences {
         size_t freeEntries();
 };
 
+#include "Preferences.cpp"
+
 #endif